@@ -0,0 +1,89 @@
+extern "C" {
+  #include <libavutil/frame.h>
+  #include <libavutil/pixdesc.h>
+  #include <libavutil/time.h>
+  #include <libswscale/swscale.h>
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/yuv2rgb.h"
+
+/**
+ *  yuv2rgb kernels against sws_scale (with ffplay's bicubic default and with
+ *  fast bilinear) at 1080p and 4K. usage: yuv2rgb_bench [iterations]
+ */
+
+static AVFrame *alloc_source(enum AVPixelFormat fmt, int width, int height)
+{
+  AVFrame *frame = av_frame_alloc();
+  if (!frame)
+    return NULL;
+  frame->format = fmt;
+  frame->width = width;
+  frame->height = height;
+  frame->colorspace = AVCOL_SPC_BT709;
+  if (av_frame_get_buffer(frame, 32) < 0) {
+    av_frame_free(&frame);
+    return NULL;
+  }
+  // some texture, so nothing is constant folded or trivially predicted
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+  for (int p = 0; p < 3 && frame->data[p]; p++) {
+    int rows = p ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+    for (int y = 0; y < rows; y++)
+      for (int x = 0; x < frame->linesize[p]; x++)
+        frame->data[p][y * frame->linesize[p] + x] = (uint8_t)(x * 7 + y * 13 + p * 31);
+  }
+  return frame;
+}
+
+static double bench_kernel(AVFrame *src, uint8_t *dst, int dst_linesize, int iterations)
+{
+  int64_t start = av_gettime_relative();
+  for (int i = 0; i < iterations; i++)
+    yuv2rgb_convert(src, dst, dst_linesize, AV_PIX_FMT_BGRA, 0, src->height);
+  return (av_gettime_relative() - start) / 1000.0 / iterations;
+}
+
+static double bench_sws(AVFrame *src, uint8_t *dst, int dst_linesize, int iterations, int flags)
+{
+  struct SwsContext *sws = sws_getContext(src->width, src->height, (enum AVPixelFormat)src->format,
+                                          src->width, src->height, AV_PIX_FMT_BGRA, flags, NULL, NULL, NULL);
+  if (!sws)
+    return -1;
+  int64_t start = av_gettime_relative();
+  for (int i = 0; i < iterations; i++)
+    sws_scale(sws, (const uint8_t * const *)src->data, src->linesize, 0, src->height, &dst, &dst_linesize);
+  double ms = (av_gettime_relative() - start) / 1000.0 / iterations;
+  sws_freeContext(sws);
+  return ms;
+}
+
+int main(int argc, char *argv[])
+{
+  static const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+  static const enum AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV422P };
+  int iterations = argc > 1 ? atoi(argv[1]) : 50;
+
+  printf("kernel set: %s, %d iterations, ms per frame\n", yuv2rgb_kernel_name(), iterations);
+  printf("%-10s %-9s %10s %12s %14s\n", "size", "format", "yuv2rgb", "sws bicubic", "sws fast_bil");
+  for (int s = 0; s < 2; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    int dst_linesize = width * 4;
+    uint8_t *dst = (uint8_t *)av_malloc((size_t)dst_linesize * height);
+    for (int f = 0; f < 3 && dst; f++) {
+      AVFrame *src = alloc_source(formats[f], width, height);
+      if (!src)
+        break;
+      double k  = bench_kernel(src, dst, dst_linesize, iterations);
+      double sb = bench_sws(src, dst, dst_linesize, iterations, SWS_BICUBIC);
+      double sf = bench_sws(src, dst, dst_linesize, iterations, SWS_FAST_BILINEAR);
+      printf("%4dx%-5d %-9s %10.3f %12.3f %14.3f\n", width, height, av_get_pix_fmt_name(formats[f]), k, sb, sf);
+      av_frame_free(&src);
+    }
+    av_free(dst);
+  }
+  return 0;
+}
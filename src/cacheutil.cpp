@@ -0,0 +1,154 @@
+extern "C" {
+  #include <libavutil/avstring.h>
+  #include <libavutil/error.h>
+  #include <libavutil/mem.h>
+}
+
+#include <SDL.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "cacheutil.h"
+
+int cache_file_id(const char *path, CacheFileId *id)
+{
+#ifdef _WIN32
+  // plain stat() is 32-bit on mingw, recordings are much larger than that
+  struct __stat64 st;
+  if (_stat64(path, &st) < 0)
+    return AVERROR(errno);
+#else
+  struct stat st;
+  if (stat(path, &st) < 0)
+    return AVERROR(errno);
+#endif
+  id->size = st.st_size;
+  id->mtime = st.st_mtime;
+  return 0;
+}
+
+int cache_file_path(char *buf, size_t buf_size, const char *media, const char *ext, int sidecar)
+{
+  if (sidecar) {
+    snprintf(buf, buf_size, "%s%s", media, ext);
+    return 0;
+  }
+
+  char *dir = SDL_GetPrefPath("ksplayer", "cache");
+  if (!dir)
+    return AVERROR(ENOENT);
+
+  // FNV-1a of the media path keeps cache names short and filesystem safe
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *p = media; *p; p++) {
+    hash ^= (uint8_t)*p;
+    hash *= 0x100000001b3ULL;
+  }
+  snprintf(buf, buf_size, "%s%016llx%s", dir, (unsigned long long)hash, ext);
+  SDL_free(dir);
+  return 0;
+}
+
+int cache_map_file(const char *path, CacheMapping *map)
+{
+  memset(map, 0, sizeof(*map));
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return AVERROR(ENOENT);
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return AVERROR_INVALIDDATA;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping)
+    return AVERROR(EIO);
+  const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    return AVERROR(EIO);
+  }
+  map->data = (const uint8_t *)data;
+  map->size = (size_t)size.QuadPart;
+  map->handle = mapping;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return AVERROR(errno);
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return AVERROR_INVALIDDATA;
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return AVERROR(EIO);
+  map->data = (const uint8_t *)data;
+  map->size = st.st_size;
+#endif
+  return 0;
+}
+
+void cache_unmap_file(CacheMapping *map)
+{
+  if (!map->data)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(map->data);
+  CloseHandle((HANDLE)map->handle);
+#else
+  munmap((void *)map->data, map->size);
+#endif
+  memset(map, 0, sizeof(*map));
+}
+
+int cache_write_file(const char *path, const void *head, size_t head_size, const void *body, size_t body_size)
+{
+  char *tmp = av_asprintf("%s.tmp", path);
+  if (!tmp)
+    return AVERROR(ENOMEM);
+
+  int ret = 0;
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    ret = AVERROR(errno);
+    goto end;
+  }
+  if (fwrite(head, 1, head_size, f) != head_size ||
+      (body_size && fwrite(body, 1, body_size, f) != body_size))
+    ret = AVERROR(EIO);
+  if (fclose(f) && !ret)
+    ret = AVERROR(EIO);
+  if (ret < 0) {
+    remove(tmp);
+    goto end;
+  }
+
+#ifdef _WIN32
+  // rename() does not replace an existing file on windows
+  if (!MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING))
+    ret = AVERROR(EIO);
+#else
+  if (rename(tmp, path) < 0)
+    ret = AVERROR(errno);
+#endif
+  if (ret < 0)
+    remove(tmp);
+end:
+  av_free(tmp);
+  return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef KSPLAYER_CACHEUTIL_H
+#define KSPLAYER_CACHEUTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* identity of a media file: cached data is only trusted while this matches */
+typedef struct CacheFileId {
+  int64_t size;
+  int64_t mtime;
+} CacheFileId;
+
+/* read-only view of a whole file */
+typedef struct CacheMapping {
+  const uint8_t *data;
+  size_t size;
+  void *handle;   // platform mapping handle
+} CacheMapping;
+
+int cache_file_id(const char *path, CacheFileId *id);
+
+/**
+ *  build "<media><ext>" next to the media file (sidecar != 0) or
+ *  "<pref path>/<hash of media path><ext>" in the per-user cache directory
+ */
+int cache_file_path(char *buf, size_t buf_size, const char *media, const char *ext, int sidecar);
+
+int cache_map_file(const char *path, CacheMapping *map);
+void cache_unmap_file(CacheMapping *map);
+
+/* write to "<path>.tmp" first and rename, so readers never map a torn file */
+int cache_write_file(const char *path, const void *head, size_t head_size, const void *body, size_t body_size);
+
+#endif
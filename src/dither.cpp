@@ -0,0 +1,203 @@
+extern "C" {
+  #include <libavutil/common.h>
+  #include <libavutil/cpu.h>
+  #include <libavutil/error.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "dither.h"
+
+/* 8x8 Bayer matrix, thresholds 0..63 */
+static const uint8_t bayer8[8][8] = {
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/**
+ *  out = min((sample + d[x & 15]) >> shift, 255), the add saturating at 0xffff.
+ *  d holds one row of the matrix scaled to [0, 1 << shift), for 16 samples:
+ *  twice over for planes, every entry doubled for interleaved UV so U and V of
+ *  a pair get the same threshold. Interleaved rows write even samples to dst0
+ *  and odd ones to dst1; n counts samples, not pairs
+ */
+typedef void (*DitherRowFunc)(const uint16_t *src, uint8_t *dst0, uint8_t *dst1, int x, int n,
+                              int shift, const uint16_t *d);
+
+/* reference kernel, also converts the tail samples for the SIMD ones */
+template <bool Interleaved>
+static void dither_row_c(const uint16_t *src, uint8_t *dst0, uint8_t *dst1, int x, int n,
+                         int shift, const uint16_t *d)
+{
+  for (; x < n; x++) {
+    int v = FFMIN(FFMIN(src[x] + d[x & 15], 0xffff) >> shift, 255);
+    if (Interleaved)
+      (x & 1 ? dst1 : dst0)[x >> 1] = v;
+    else
+      dst0[x] = v;
+  }
+}
+
+#if HAVE_X86_KERNELS
+
+template <bool Interleaved>
+__attribute__((target("sse2")))
+static void dither_row_sse2(const uint16_t *src, uint8_t *dst0, uint8_t *dst1, int x, int n,
+                            int shift, const uint16_t *d)
+{
+  const __m128i d0 = _mm_loadu_si128((const __m128i *)d);
+  const __m128i d1 = _mm_loadu_si128((const __m128i *)(d + 8));
+  const __m128i sh = _mm_cvtsi32_si128(shift);
+  const __m128i lo = _mm_set1_epi32(0xffff);
+
+  for (; x + 16 <= n; x += 16) {
+    __m128i a = _mm_srl_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + x)), d0), sh);
+    __m128i b = _mm_srl_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + x + 8)), d1), sh);
+    if (Interleaved) {
+      // at most 256 after the shift, so the signed 32 -> 16 pack is safe
+      __m128i u = _mm_packs_epi32(_mm_and_si128(a, lo), _mm_and_si128(b, lo));
+      __m128i v = _mm_packs_epi32(_mm_srli_epi32(a, 16), _mm_srli_epi32(b, 16));
+      __m128i uv = _mm_packus_epi16(u, v);
+      _mm_storel_epi64((__m128i *)(dst0 + (x >> 1)), uv);
+      _mm_storel_epi64((__m128i *)(dst1 + (x >> 1)), _mm_srli_si128(uv, 8));
+    }
+    else {
+      _mm_storeu_si128((__m128i *)(dst0 + x), _mm_packus_epi16(a, b));
+    }
+  }
+  dither_row_c<Interleaved>(src, dst0, dst1, x, n, shift, d);
+}
+
+template <bool Interleaved>
+__attribute__((target("avx2")))
+static void dither_row_avx2(const uint16_t *src, uint8_t *dst0, uint8_t *dst1, int x, int n,
+                            int shift, const uint16_t *d)
+{
+  const __m256i dd = _mm256_loadu_si256((const __m256i *)d);
+  const __m128i sh = _mm_cvtsi32_si128(shift);
+  const __m256i lo = _mm256_set1_epi32(0xffff);
+
+  for (; x + 32 <= n; x += 32) {
+    __m256i a = _mm256_srl_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + x)), dd), sh);
+    __m256i b = _mm256_srl_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + x + 16)), dd), sh);
+    if (Interleaved) {
+      // the per-lane packs leave quads in 0,2,1,3 order, the permutes put them back
+      __m256i u = _mm256_packus_epi32(_mm256_and_si256(a, lo), _mm256_and_si256(b, lo));
+      __m256i v = _mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16));
+      u = _mm256_permute4x64_epi64(u, _MM_SHUFFLE(3, 1, 2, 0));
+      v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+      __m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(u, v), _MM_SHUFFLE(3, 1, 2, 0));
+      _mm_storeu_si128((__m128i *)(dst0 + (x >> 1)), _mm256_castsi256_si128(uv));
+      _mm_storeu_si128((__m128i *)(dst1 + (x >> 1)), _mm256_extracti128_si256(uv, 1));
+    }
+    else {
+      __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+      _mm256_storeu_si256((__m256i *)(dst0 + x), p);
+    }
+  }
+  dither_row_c<Interleaved>(src, dst0, dst1, x, n, shift, d);
+}
+
+#endif
+
+/* [interleaved] */
+typedef struct DitherKernels {
+  const char *name;
+  DitherRowFunc row[2];
+} DitherKernels;
+
+static const DitherKernels kernels_c = {
+  "c", { dither_row_c<false>, dither_row_c<true> },
+};
+
+#if HAVE_X86_KERNELS
+static const DitherKernels kernels_sse2 = {
+  "sse2", { dither_row_sse2<false>, dither_row_sse2<true> },
+};
+
+static const DitherKernels kernels_avx2 = {
+  "avx2", { dither_row_avx2<false>, dither_row_avx2<true> },
+};
+#endif
+
+static const DitherKernels *select_kernels(void)
+{
+#if HAVE_X86_KERNELS
+  int flags = av_get_cpu_flags();
+  if (flags & AV_CPU_FLAG_AVX2)
+    return &kernels_avx2;
+  if (flags & AV_CPU_FLAG_SSE2)
+    return &kernels_sse2;
+#endif
+  return &kernels_c;
+}
+
+static const DitherKernels *get_kernels(void)
+{
+  static const DitherKernels *kernels = select_kernels();
+  return kernels;
+}
+
+/* thresholds of matrix row y for 16 samples, scaled to [0, 1 << shift) */
+static void dither_row_thresholds(uint16_t d[16], int y, int shift, int interleaved)
+{
+  for (int i = 0; i < 16; i++) {
+    int t = bayer8[y & 7][(interleaved ? i >> 1 : i) & 7];
+    d[i] = shift <= 6 ? t >> (6 - shift) : t << (shift - 6);
+  }
+}
+
+int dither_supported(enum AVPixelFormat src)
+{
+  return src == AV_PIX_FMT_YUV420P10LE || src == AV_PIX_FMT_YUV420P12LE || src == AV_PIX_FMT_P010LE;
+}
+
+int dither_convert(const AVFrame *src, uint8_t *const dst[3], const int dst_linesize[3], int y_start, int y_end)
+{
+  if (!dither_supported((enum AVPixelFormat)src->format))
+    return AVERROR(ENOSYS);
+
+  // p010 keeps its 10 bits at the top of each sample
+  int p010 = src->format == AV_PIX_FMT_P010LE;
+  int shift = p010 ? 8 : src->format == AV_PIX_FMT_YUV420P12LE ? 4 : 2;
+  const DitherKernels *k = get_kernels();
+  int chroma_w = AV_CEIL_RSHIFT(src->width, 1);
+  uint16_t d[16];
+
+  y_end = FFMIN(y_end, src->height);
+  for (int y = y_start; y < y_end; y++) {
+    dither_row_thresholds(d, y, shift, 0);
+    k->row[0]((const uint16_t *)(src->data[0] + (ptrdiff_t)y * src->linesize[0]),
+              dst[0] + (ptrdiff_t)y * dst_linesize[0], NULL, 0, src->width, shift, d);
+  }
+
+  for (int y = AV_CEIL_RSHIFT(y_start, 1); y < AV_CEIL_RSHIFT(y_end, 1); y++) {
+    uint8_t *u = dst[1] + (ptrdiff_t)y * dst_linesize[1];
+    uint8_t *v = dst[2] + (ptrdiff_t)y * dst_linesize[2];
+    dither_row_thresholds(d, y, shift, p010);
+    if (p010) {
+      k->row[1]((const uint16_t *)(src->data[1] + (ptrdiff_t)y * src->linesize[1]), u, v, 0, 2 * chroma_w, shift, d);
+    }
+    else {
+      k->row[0]((const uint16_t *)(src->data[1] + (ptrdiff_t)y * src->linesize[1]), u, NULL, 0, chroma_w, shift, d);
+      k->row[0]((const uint16_t *)(src->data[2] + (ptrdiff_t)y * src->linesize[2]), v, NULL, 0, chroma_w, shift, d);
+    }
+  }
+  return 0;
+}
+
+const char *dither_kernel_name(void)
+{
+  return get_kernels()->name;
+}
@@ -0,0 +1,28 @@
+#ifndef KSPLAYER_DITHER_H
+#define KSPLAYER_DITHER_H
+
+extern "C" {
+  #include <libavutil/frame.h>
+  #include <libavutil/pixfmt.h>
+}
+
+/**
+ *  10/12-bit 4:2:0 (yuv420p10, yuv420p12, p010) -> 8-bit yuv420p for an IYUV
+ *  texture, since SDL has no texture format with more than 8 bits per sample.
+ *  An 8x8 ordered dither is added before the samples are cut to 8 bits, which
+ *  hides the banding plain truncation leaves in gradients. p010 chroma is split
+ *  into U and V planes on the way. Scalar, SSE2 and AVX2 row kernels produce
+ *  identical output; the widest one the CPU has is picked at runtime.
+ */
+int dither_supported(enum AVPixelFormat src);
+
+/**
+ *  dither rows [y_start, y_end) of src into the yuv420p planes dst, which point
+ *  at row 0. Row ranges of one frame may be converted concurrently
+ */
+int dither_convert(const AVFrame *src, uint8_t *const dst[3], const int dst_linesize[3], int y_start, int y_end);
+
+/* name of the kernel set in use, for logs */
+const char *dither_kernel_name(void);
+
+#endif
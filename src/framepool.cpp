@@ -0,0 +1,236 @@
+extern "C" {
+  #include <libavutil/buffer.h>
+  #include <libavutil/imgutils.h>
+  #include <libavutil/log.h>
+  #include <libavutil/mem.h>
+  #include <libavutil/pixdesc.h>
+}
+
+#include <SDL.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "framepool.h"
+
+#define FRAMEPOOL_HUGE_PAGE (2 * 1024 * 1024)
+
+typedef struct FramePool {
+  SDL_mutex *mutex;       // frame threads call get_buffer2 concurrently
+  AVBufferPool *pools[4];
+  int format;
+  int width, height;
+  int linesize[4];
+  int nb_planes;
+} FramePool;
+
+static void framepool_buffer_free(void *opaque, uint8_t *data)
+{
+#ifdef _WIN32
+  VirtualFree(data, 0, MEM_RELEASE);
+#else
+  munmap(data, (size_t)(uintptr_t)opaque);
+#endif
+}
+
+/**
+ *  whole pages straight from the system instead of av_malloc: page alignment
+ *  covers FRAMEPOOL_ALIGN, and planes of a megabyte or more are rounded up to
+ *  huge pages, which cuts TLB misses when decoder and uploads stream through them.
+ *  Transparent huge pages only back 2 MiB aligned ranges, so those mappings are
+ *  over-allocated by one huge page and trimmed to an aligned start
+ */
+static AVBufferRef *framepool_buffer_alloc(void *, int size)
+{
+  size_t bytes = size;
+  uint8_t *data;
+
+#ifdef _WIN32
+  // large pages need SeLockMemoryPrivilege, which a player seldom has
+  static int large_pages = GetLargePageMinimum() ? 1 : 0;
+  data = NULL;
+  if (large_pages && bytes >= FRAMEPOOL_HUGE_PAGE / 2) {
+    size_t large = (bytes + GetLargePageMinimum() - 1) & ~(GetLargePageMinimum() - 1);
+    data = (uint8_t *)VirtualAlloc(NULL, large, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!data)
+      large_pages = 0;
+  }
+  if (!data)
+    data = (uint8_t *)VirtualAlloc(NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (!data)
+    return NULL;
+#else
+  if (bytes >= FRAMEPOOL_HUGE_PAGE / 2) {
+    bytes = (bytes + FRAMEPOOL_HUGE_PAGE - 1) & ~(size_t)(FRAMEPOOL_HUGE_PAGE - 1);
+    uint8_t *raw = (uint8_t *)mmap(NULL, bytes + FRAMEPOOL_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+      return NULL;
+    size_t head = FFALIGN((uintptr_t)raw, FRAMEPOOL_HUGE_PAGE) - (uintptr_t)raw;
+    if (head)
+      munmap(raw, head);
+    data = raw + head;
+    munmap(data + bytes, FRAMEPOOL_HUGE_PAGE - head);
+  }
+  else {
+    data = (uint8_t *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+      return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (bytes >= FRAMEPOOL_HUGE_PAGE)
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+
+  AVBufferRef *buf = av_buffer_create(data, size, framepool_buffer_free, (void *)(uintptr_t)bytes, 0);
+  if (!buf)
+    framepool_buffer_free((void *)(uintptr_t)bytes, data);
+  return buf;
+}
+
+static void framepool_reset(FramePool *pool)
+{
+  for (int i = 0; i < 4; i++)
+    av_buffer_pool_uninit(&pool->pools[i]);   // buffers still out are freed on their return
+  pool->format = AV_PIX_FMT_NONE;
+}
+
+/**
+ *  the layout of avcodec_default_get_buffer2 with FRAMEPOOL_ALIGN as the least
+ *  stride alignment. Planes are never aligned one by one: the width grows until
+ *  the linesizes it gives are all aligned, so chroma keeps its ratio to luma,
+ *  which the mpegvideo family, svq1 and snow rely on to find uvlinesize
+ */
+static int framepool_configure(FramePool *pool, AVCodecContext *avctx, AVFrame *frame)
+{
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  int w = frame->width, h = frame->height;
+  uint8_t *data[4];
+  size_t size[4] = { 0 };
+  int unaligned;
+  int ret;
+
+  framepool_reset(pool);
+
+  avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+  do {
+    if ((ret = av_image_fill_linesizes(pool->linesize, (enum AVPixelFormat)frame->format, w)) < 0)
+      return ret;
+    // the lowest bit set in w, so the next try is aligned one bit further
+    w += w & ~(w - 1);
+
+    unaligned = 0;
+    for (int i = 0; i < 4; i++)
+      unaligned |= pool->linesize[i] % FFMAX(FRAMEPOOL_ALIGN, linesize_align[i]);
+  } while (unaligned);
+
+  pool->nb_planes = 0;
+  for (int i = 0; i < 4; i++)
+    if (pool->linesize[i])
+      pool->nb_planes = i + 1;
+
+  // offsets of the planes as if they were one buffer, to get each plane's size
+  if ((ret = av_image_fill_pointers(data, (enum AVPixelFormat)frame->format, h, NULL, pool->linesize)) < 0)
+    return ret;
+  for (int i = 0; i < pool->nb_planes; i++)
+    size[i] = (i + 1 < pool->nb_planes ? (size_t)(data[i + 1] - data[i]) : ret - (size_t)(data[i] - data[0]));
+
+  for (int i = 0; i < pool->nb_planes; i++) {
+    // decoders may read and write a little past the last row
+    pool->pools[i] = av_buffer_pool_init2(size[i] + 16 + FRAMEPOOL_ALIGN - 1, NULL, framepool_buffer_alloc, NULL);
+    if (!pool->pools[i]) {
+      framepool_reset(pool);
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  pool->format = frame->format;
+  pool->width = frame->width;
+  pool->height = frame->height;
+  av_log(avctx, AV_LOG_VERBOSE, "frame pool: %dx%d %s, linesizes %d %d %d %d\n",
+         frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat)frame->format),
+         pool->linesize[0], pool->linesize[1], pool->linesize[2], pool->linesize[3]);
+  return 0;
+}
+
+static int framepool_get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+  FramePool *pool = (FramePool *)avctx->opaque;
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+  int ret;
+
+  if (!pool || !desc || avctx->hw_frames_ctx || !(avctx->codec->capabilities & AV_CODEC_CAP_DR1) ||
+      (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)))
+    return avcodec_default_get_buffer2(avctx, frame, flags);
+
+  // the first frame thread to see a new size reconfigures; the others wait for it
+  // rather than take buffers from pools that are being replaced
+  SDL_LockMutex(pool->mutex);
+  if (pool->format != frame->format || pool->width != frame->width || pool->height != frame->height) {
+    if ((ret = framepool_configure(pool, avctx, frame)) < 0) {
+      SDL_UnlockMutex(pool->mutex);
+      return ret;
+    }
+  }
+
+  ret = 0;
+  memset(frame->data, 0, sizeof(frame->data));
+  for (int i = 0; i < pool->nb_planes; i++) {
+    if (!(frame->buf[i] = av_buffer_pool_get(pool->pools[i]))) {
+      ret = AVERROR(ENOMEM);
+      break;
+    }
+    frame->data[i] = frame->buf[i]->data;
+    frame->linesize[i] = pool->linesize[i];
+  }
+  SDL_UnlockMutex(pool->mutex);
+  if (ret < 0) {
+    av_frame_unref(frame);
+    return ret;
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+int framepool_install(AVCodecContext *avctx)
+{
+  if (avctx->codec_type != AVMEDIA_TYPE_VIDEO)
+    return 0;
+
+  FramePool *pool = (FramePool *)av_mallocz(sizeof(*pool));
+  if (!pool)
+    return AVERROR(ENOMEM);
+  if (!(pool->mutex = SDL_CreateMutex())) {
+    av_log(avctx, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+    av_free(pool);
+    return AVERROR(ENOMEM);
+  }
+  pool->format = AV_PIX_FMT_NONE;
+  avctx->opaque = pool;
+  avctx->get_buffer2 = framepool_get_buffer2;
+  // otherwise frame threading calls get_buffer2 from the user thread only, one
+  // frame at a time, and codecs that allocate after ff_thread_finish_setup break
+  avctx->thread_safe_callbacks = 1;
+  return 0;
+}
+
+void framepool_uninstall(AVCodecContext *avctx)
+{
+  if (!avctx || avctx->get_buffer2 != framepool_get_buffer2)
+    return;
+  FramePool *pool = (FramePool *)avctx->opaque;
+  avctx->get_buffer2 = avcodec_default_get_buffer2;
+  avctx->opaque = NULL;
+  if (pool) {
+    framepool_reset(pool);
+    SDL_DestroyMutex(pool->mutex);
+    av_free(pool);
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef KSPLAYER_FRAMEPOOL_H
+#define KSPLAYER_FRAMEPOOL_H
+
+extern "C" {
+  #include <libavcodec/avcodec.h>
+}
+
+/**
+ *  get_buffer2 for video decoders: planes come from per-plane buffer pools of
+ *  page-aligned (huge pages where the system gives them) memory, with every
+ *  linesize a multiple of 64. Such rows go to a streaming texture in a single
+ *  aligned copy. Codecs without AV_CODEC_CAP_DR1, hwaccel and paletted output
+ *  keep the default allocator. The callback is thread safe, so frame threads
+ *  allocate in parallel. The pool lives in avctx->opaque, so call
+ *  framepool_uninstall before the context is freed.
+ */
+#define FRAMEPOOL_ALIGN 64
+
+int framepool_install(AVCodecContext *avctx);
+void framepool_uninstall(AVCodecContext *avctx);
+
+#endif
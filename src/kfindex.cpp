@@ -0,0 +1,243 @@
+extern "C" {
+  #include <libavutil/avstring.h>
+  #include <libavutil/common.h>
+  #include <libavutil/log.h>
+  #include <libavutil/mem.h>
+}
+
+#include <string.h>
+
+#include "kfindex.h"
+
+/* index of the first entry with pts > target */
+static int64_t upper_bound(const KeyframeIndexEntry *e, int64_t n, int64_t pts)
+{
+  int64_t lo = 0, hi = n;
+  while (lo < hi) {
+    int64_t mid = lo + ((hi - lo) >> 1);
+    if (e[mid].pts <= pts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int kfindex_load(KeyframeIndex *idx, const char *path)
+{
+  int ret;
+  if ((ret = cache_map_file(path, &idx->map)) < 0)
+    return ret;
+
+  const KeyframeIndexHeader *h = (const KeyframeIndexHeader *)idx->map.data;
+  if (idx->map.size < sizeof(*h) ||
+      h->magic != KFINDEX_MAGIC || h->version != KFINDEX_VERSION ||
+      h->stream_index != idx->stream_index ||
+      h->tb_num != idx->time_base.num || h->tb_den != idx->time_base.den ||
+      h->file_size != idx->file_id.size || h->file_mtime != idx->file_id.mtime ||
+      h->nb_entries < 0 ||
+      (idx->map.size - sizeof(*h)) / sizeof(KeyframeIndexEntry) < (uint64_t)h->nb_entries) {
+    // stale or foreign index: it will be rewritten on close
+    av_log(NULL, AV_LOG_VERBOSE, "ignoring stale keyframe index %s\n", path);
+    cache_unmap_file(&idx->map);
+    return AVERROR_INVALIDDATA;
+  }
+
+  idx->mapped = (const KeyframeIndexEntry *)(idx->map.data + sizeof(*h));
+  idx->nb_mapped = h->nb_entries;
+  av_strlcpy(idx->path, path, sizeof(idx->path));
+  av_log(NULL, AV_LOG_VERBOSE, "loaded %" PRId64 " keyframes from %s\n", idx->nb_mapped, path);
+  return 0;
+}
+
+int kfindex_open(KeyframeIndex *idx, const char *filename, int stream_index, AVRational time_base, int sidecar)
+{
+  char path[1024];
+  int ret;
+
+  memset(idx, 0, sizeof(*idx));
+  idx->run_pts = AV_NOPTS_VALUE;
+  idx->stream_index = stream_index;
+  idx->time_base = time_base;
+  av_strlcpy(idx->filename, filename, sizeof(idx->filename));
+  if ((ret = cache_file_id(filename, &idx->file_id)) < 0)
+    return ret;   // not a local file, nothing to index against
+  if (!(idx->mutex = SDL_CreateMutex())) {
+    av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+    return AVERROR(ENOMEM);
+  }
+
+  // sidecar first when asked for, then the per-user cache directory
+  for (int side = !!sidecar; side >= 0; side--) {
+    if (cache_file_path(path, sizeof(path), filename, KFINDEX_EXT, side) < 0)
+      continue;
+    if (!idx->path[0])
+      av_strlcpy(idx->path, path, sizeof(idx->path));
+    if (kfindex_load(idx, path) >= 0)
+      break;
+  }
+  return 0;
+}
+
+void kfindex_add(KeyframeIndex *idx, int64_t pts, int64_t pos)
+{
+  KeyframeIndexEntry *entries;
+  int64_t m;
+  int i, flags;
+
+  if (!idx->mutex || pts == AV_NOPTS_VALUE || pos < 0)
+    return;
+
+  SDL_LockMutex(idx->mutex);
+  // the previous keyframe of this run went in just before, with nothing skipped in between
+  flags = idx->run_pts != AV_NOPTS_VALUE && idx->run_pts < pts ? KFINDEX_FLAG_CHAINED : 0;
+  idx->run_pts = pts;
+
+  m = upper_bound(idx->mapped, idx->nb_mapped, pts);
+  if (m > 0 && idx->mapped[m - 1].pts == pts && (idx->mapped[m - 1].flags & KFINDEX_FLAG_CHAINED || !flags))
+    goto out;
+
+  // playback is mostly linear, so this is an append in the common case
+  i = (int)upper_bound(idx->entries, idx->nb_entries, pts);
+  if (i > 0 && idx->entries[i - 1].pts == pts) {
+    if (flags & ~idx->entries[i - 1].flags) {
+      idx->entries[i - 1].flags |= flags;
+      idx->dirty = 1;
+    }
+    goto out;
+  }
+
+  entries = (KeyframeIndexEntry *)av_fast_realloc(idx->entries, &idx->entries_size,
+                                                  (idx->nb_entries + 1) * sizeof(*entries));
+  if (!entries)
+    goto out;
+  idx->entries = entries;
+  memmove(&entries[i + 1], &entries[i], (idx->nb_entries - i) * sizeof(*entries));
+  entries[i].pts = pts;
+  entries[i].pos = pos;
+  entries[i].flags = flags;
+  entries[i].reserved = 0;
+  idx->nb_entries++;
+  idx->dirty = 1;
+out:
+  SDL_UnlockMutex(idx->mutex);
+}
+
+void kfindex_break(KeyframeIndex *idx)
+{
+  if (!idx->mutex)
+    return;
+  SDL_LockMutex(idx->mutex);
+  idx->run_pts = AV_NOPTS_VALUE;
+  SDL_UnlockMutex(idx->mutex);
+}
+
+int kfindex_lookup(KeyframeIndex *idx, int64_t pts, KeyframeIndexEntry *entry)
+{
+  KeyframeIndexEntry next;
+  int found = 0, has_next = 0;
+
+  if (!idx->mutex)
+    return AVERROR(ENOENT);
+
+  SDL_LockMutex(idx->mutex);
+  int64_t m = upper_bound(idx->mapped, idx->nb_mapped, pts);
+  if (m > 0) {
+    *entry = idx->mapped[m - 1];
+    found = 1;
+  }
+  if (m < idx->nb_mapped) {
+    next = idx->mapped[m];
+    has_next = 1;
+  }
+  int64_t i = upper_bound(idx->entries, idx->nb_entries, pts);
+  if (i > 0 && (!found || idx->entries[i - 1].pts > entry->pts)) {
+    *entry = idx->entries[i - 1];
+    found = 1;
+  }
+  if (i < idx->nb_entries && (!has_next || idx->entries[i].pts <= next.pts)) {
+    // the same keyframe from both sources: chained if either run saw its predecessor
+    int flags = has_next && idx->entries[i].pts == next.pts ? next.flags : 0;
+    next = idx->entries[i];
+    next.flags |= flags;
+    has_next = 1;
+  }
+  SDL_UnlockMutex(idx->mutex);
+
+  // the two are consecutive keyframes of the file only if the later one is chained;
+  // otherwise pts may sit in a stretch nobody has demuxed, minutes past the entry
+  if (!found || !has_next || !(next.flags & KFINDEX_FLAG_CHAINED))
+    return AVERROR(ENOENT);
+  return 0;
+}
+
+int kfindex_save(KeyframeIndex *idx)
+{
+  KeyframeIndexHeader h = {};
+  KeyframeIndexEntry *merged;
+  int64_t n = 0, m = 0, i = 0, total;
+  int ret;
+
+  if (!idx->mutex || !idx->dirty)
+    return 0;
+
+  SDL_LockMutex(idx->mutex);
+  total = idx->nb_mapped + idx->nb_entries;
+  merged = (KeyframeIndexEntry *)av_malloc_array(total, sizeof(*merged));
+  if (!merged) {
+    SDL_UnlockMutex(idx->mutex);
+    return AVERROR(ENOMEM);
+  }
+  while (m < idx->nb_mapped || i < idx->nb_entries) {
+    if (i >= idx->nb_entries || (m < idx->nb_mapped && idx->mapped[m].pts <= idx->entries[i].pts))
+      merged[n++] = idx->mapped[m++];
+    else
+      merged[n++] = idx->entries[i++];
+    if (n > 1 && merged[n - 1].pts == merged[n - 2].pts) {
+      merged[n - 2].flags |= merged[n - 1].flags;
+      n--;
+    }
+  }
+  // windows refuses to replace a file that is still mapped, keep the merged copy instead
+  cache_unmap_file(&idx->map);
+  idx->mapped = NULL;
+  idx->nb_mapped = 0;
+  av_free(idx->entries);
+  idx->entries = merged;
+  idx->nb_entries = (int)n;
+  idx->entries_size = (unsigned int)(total * sizeof(*merged));
+
+  h.magic = KFINDEX_MAGIC;
+  h.version = KFINDEX_VERSION;
+  h.stream_index = idx->stream_index;
+  h.tb_num = idx->time_base.num;
+  h.tb_den = idx->time_base.den;
+  h.file_size = idx->file_id.size;
+  h.file_mtime = idx->file_id.mtime;
+  h.nb_entries = n;
+  ret = cache_write_file(idx->path, &h, sizeof(h), merged, n * sizeof(*merged));
+  if (ret < 0) {
+    // media directory is read-only (network share, optical disc): use the cache directory
+    char path[1024];
+    if (cache_file_path(path, sizeof(path), idx->filename, KFINDEX_EXT, 0) >= 0 && strcmp(path, idx->path)) {
+      av_strlcpy(idx->path, path, sizeof(idx->path));
+      ret = cache_write_file(idx->path, &h, sizeof(h), merged, n * sizeof(*merged));
+    }
+  }
+  if (ret < 0)
+    av_log(NULL, AV_LOG_WARNING, "could not save keyframe index %s\n", idx->path);
+  else
+    idx->dirty = 0;
+
+  SDL_UnlockMutex(idx->mutex);
+  return ret;
+}
+
+void kfindex_close(KeyframeIndex *idx)
+{
+  cache_unmap_file(&idx->map);
+  av_freep(&idx->entries);
+  if (idx->mutex)
+    SDL_DestroyMutex(idx->mutex);
+  memset(idx, 0, sizeof(*idx));
+}
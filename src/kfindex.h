@@ -0,0 +1,91 @@
+#ifndef KSPLAYER_KFINDEX_H
+#define KSPLAYER_KFINDEX_H
+
+extern "C" {
+  #include <libavutil/common.h>
+  #include <libavutil/rational.h>
+}
+
+#include <SDL.h>
+
+#include "cacheutil.h"
+
+/**
+ *  keyframe index for files whose container index is missing or useless
+ *  (raw MPEG-TS, badly muxed MKV). read_thread records keyframe pts -> byte
+ *  position while demuxing and seeks jump straight to the recorded position
+ *  instead of bisecting the file. The index is persisted in the per-user cache
+ *  directory, or with sidecar set as "<media>.ksidx" next to the media where
+ *  that is writable, and mapped read-only on next open.
+ *  There is no background scan: a file is indexed as far as it has been
+ *  played, inline on read_thread, at one binary search per keyframe.
+ *
+ *  an entry is only trusted when the next keyframe was recorded in the same
+ *  linear run of demuxing (KFINDEX_FLAG_CHAINED on it); a target past the end
+ *  of a run or in a gap between sessions falls back to a regular seek.
+ *
+ *  on-disk layout, little-endian:
+ *    KeyframeIndexHeader, then nb_entries KeyframeIndexEntry sorted by pts
+ */
+#define KFINDEX_EXT       ".ksidx"
+#define KFINDEX_MAGIC     MKTAG('K', 'S', 'K', 'I')
+#define KFINDEX_VERSION   2
+
+#define KFINDEX_FLAG_CHAINED  1   // the keyframe before this one in the file is indexed too
+
+typedef struct KeyframeIndexEntry {
+  int64_t pts;    // in stream time_base
+  int64_t pos;    // byte offset of the keyframe packet
+  int32_t flags;
+  int32_t reserved;
+} KeyframeIndexEntry;
+
+typedef struct KeyframeIndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t stream_index;
+  int32_t tb_num, tb_den;
+  int32_t reserved;
+  int64_t file_size;
+  int64_t file_mtime;
+  int64_t nb_entries;
+} KeyframeIndexHeader;
+
+typedef struct KeyframeIndex {
+  SDL_mutex *mutex;
+  int stream_index;
+  AVRational time_base;
+  CacheFileId file_id;
+  char filename[1024];
+  char path[1024];    // where the index is loaded from / saved to
+
+  /* persisted entries, mapped read-only */
+  CacheMapping map;
+  const KeyframeIndexEntry *mapped;
+  int64_t nb_mapped;
+
+  /* entries recorded in this session, kept sorted by pts */
+  KeyframeIndexEntry *entries;
+  int nb_entries;
+  unsigned int entries_size;
+  int dirty;
+
+  int64_t run_pts;    // last keyframe of the current linear run, AV_NOPTS_VALUE after a seek
+} KeyframeIndex;
+
+int kfindex_open(KeyframeIndex *idx, const char *filename, int stream_index, AVRational time_base, int sidecar);
+void kfindex_add(KeyframeIndex *idx, int64_t pts, int64_t pos);
+
+/* demuxing jumped (seek, loop): the next keyframe does not follow the last one added */
+void kfindex_break(KeyframeIndex *idx);
+
+/**
+ *  find the last keyframe at or before pts, provided the keyframe after it is
+ *  indexed and chained to it, so pts is known to lie between the two. return 0 if found
+ */
+int kfindex_lookup(KeyframeIndex *idx, int64_t pts, KeyframeIndexEntry *entry);
+
+int kfindex_save(KeyframeIndex *idx);
+void kfindex_close(KeyframeIndex *idx);
+
+#endif
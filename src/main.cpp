@@ -1,22 +1,317 @@
 extern "C" {
   #include <libavformat/avformat.h>
+  #include <libavfilter/avfilter.h>
+  #include <libavfilter/buffersink.h>
+  #include <libavfilter/buffersrc.h>
   #include <libswscale/swscale.h>
   #include <libswresample/swresample.h>
   #include <libavutil/avstring.h>
+  #include <libavutil/display.h>
   #include <libavutil/imgutils.h>
+  #include <libavutil/opt.h>
+  #include <libavutil/pixdesc.h>
+  #include <libavutil/spherical.h>
+  #include <libavutil/stereo3d.h>
+  #include <libavutil/time.h>
 }
 
 #include <SDL.h>
 
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "dither.h"
+#include "framepool.h"
+#include "kfindex.h"
+#include "probecache.h"
+#include "slicepool.h"
+#include "stereo.h"
+#include "texpool.h"
+#include "tonemap.h"
+#include "viewport.h"
+#include "yuv2rgb.h"
+
+#define CONVERT_MAX_SLICES 16
+
 typedef struct VideoState {
   SDL_Thread *read_tid;   // 204
 
   char *filename;         // 291
+
+  KeyframeIndex kfindex;  // keyframe pts -> byte position of the video stream
+
+  int probe_cache_hit;
+  int window_shown;
+
+  /* decoders kept warm across stream_switch, reused when codec parameters match */
+  AVCodecContext *parked_avctx[AVMEDIA_TYPE_NB];
+  int audio_dev_kept;     // audio_dev and audio_tgt survive the switch
+
+  /* playlist: the next item is opened and prerolled while this one plays; next and
+   * streams_open are written under the audio device lock, sdl_audio_callback reads them */
+  struct VideoState *next;
+  int streams_open;       // read_thread is past stream_component_open, the callback may switch to it
+  int audio_dev_shared;   // plays through another VideoState's audio device
+  int handover_pending;
+
+  /* seamless loop: a second context waits at the start of the file */
+  SDL_Thread *loop_tid;   // opens loop_ic, joined before read_thread touches it
+  AVFormatContext *loop_ic;
+  AVFormatContext *loop_old_ic;   // the previous pass, closed one splice later
+  int64_t loop_offset;    // added to every timestamp, AV_TIME_BASE units
+  int64_t loop_end;       // end of the latest packet after offsetting
+  int64_t loop_splice_time;
+  int loop_count;
+  int loop_failed;
+
+  /* mosaic: xleft/ytop/width/height are this stream's tile */
+  int audio_disable;
+  int tile_dirty;         // has a new picture for the next composite
+
+  /* picture resident in vid_texture and on screen, by serial and pictq index */
+  int shown_serial;
+  int shown_rindex;
+  int screen_damaged;     // exposed or resized since the last present
+
+  /* display matrix of the video stream, applied by SDL_RenderCopyEx rather than a filter */
+  int rotation;           // clockwise, 0 / 90 / 180 / 270
+  int rotation_hflip;     // mirrored before the rotation
+
+  /* 360 video: equirectangular pictures shown as a perspective view, dragged with the mouse */
+  Viewport viewport;
+  int viewport_available; // the stream has an equirectangular spherical mapping
+  int viewport_on;        // o switches between the view and the flat picture
+  int viewport_shown;     // vid_texture holds a view, drawn over the whole window
+  AVFrame *viewport_src;  // 10/12-bit pictures dithered to 8-bit for the remap
+
+  /* stereo 3D: packing from the container, pictures with their own side data override it */
+  AVStereo3D stereo3d;
+  int anaglyph_shown;     // vid_texture holds an anaglyph, not the packed picture
+  AVFrame *stereo_yuv;    // 10/12-bit pictures dithered ahead of the BGRA conversion
+  AVFrame *stereo_rgb;    // packed picture in BGRA for the anaglyph blend
+
+  /* bitmap subtitles: every rect of the subpq head becomes a texture once, when it first shows */
+  SDL_Texture **sub_textures;         // one per rect, NULL for rects without a bitmap
+  unsigned sub_nb_textures;
+  Frame *sub_shown;                   // subpq entry on screen with the last presented picture
+
+  struct SwsContext *img_convert_ctx[CONVERT_MAX_SLICES];   // one per conversion slice
+  TonemapContext tonemap;             // HDR pictures converted at upload
+
+  AVFilterContext *in_video_filter;   // the first filter in the video chain
+  AVFilterContext *out_video_filter;  // the last filter in the video chain
+
+  struct AudioParams audio_filter_src;
+  AVFilterContext *in_audio_filter;   // the first filter in the audio chain
+  AVFilterContext *out_audio_filter;  // the last filter in the audio chain
+  AVFilterGraph *agraph;              // audio filter graph
+  SDL_atomic_t audio_tempo_serial;    // bumped on a speed change, audio stretched before it is dropped
+
+  /* -convert_stage: decoded pictures go through convq and convert_thread into pictq */
+  FrameQueue convq;
+  SDL_Thread *convert_tid;
+  struct SwsContext *stage_convert_ctx[CONVERT_MAX_SLICES];
+  struct SwsContext *stage_scale_ctx;
+  TonemapContext stage_tonemap;
+  AVFrame *stage_tonemapped;          // full size SDR picture ahead of the scale
+
+  /* window minimized or hidden: no display work, keyframe-only decoding; set by
+   * the event loop, read by the decoder and convert threads */
+  SDL_atomic_t video_hidden;
 } VideoState;
 
+/* time-to-first-frame milestones, in startup order */
+enum StartupMilestone {
+  STARTUP_SDL_INIT,
+  STARTUP_WINDOW,
+  STARTUP_RENDERER,
+  STARTUP_OPEN_INPUT,
+  STARTUP_FIND_STREAM_INFO,
+  STARTUP_CODEC_OPEN,
+  STARTUP_AUDIO_OPEN,
+  STARTUP_FIRST_PACKET,
+  STARTUP_FIRST_FRAME,
+  STARTUP_FIRST_PRESENT,
+  STARTUP_FIRST_AUDIO_CALLBACK,
+  STARTUP_NB
+};
+
+static const char *const startup_names[STARTUP_NB] = {
+  "sdl_init", "window", "renderer", "open_input", "find_stream_info", "codec_open",
+  "audio_open", "first_packet", "first_frame", "first_present", "first_audio_cb",
+};
+
+#define STARTUP_REPORT_TIMEOUT 5000000    // report anyway if a milestone never comes
+
+static int64_t startup_origin;
+static std::atomic<int64_t> startup_times[STARTUP_NB];  // 0 until reached
+static int startup_reported;
+
+/* record the first time a milestone is reached; safe from any thread */
+static void startup_mark(enum StartupMilestone m)
+{
+  int64_t expected = 0;
+  startup_times[m].compare_exchange_strong(expected, av_gettime_relative());
+}
+
+/**
+ *  emit all milestones as one line (ms since main) once the picture is up and
+ *  audio, if any, is flowing:
+ *  startup: sdl_init=1.2 window=15.0 ... first_audio_cb=210.4 probe_cache=hit
+ */
+static void startup_report(VideoState *is)
+{
+  char line[512];
+  int64_t now = av_gettime_relative();
+
+  if (startup_reported)
+    return;
+  if (!startup_times[STARTUP_FIRST_PRESENT] && now - startup_origin < STARTUP_REPORT_TIMEOUT)
+    return;
+  if (is->audio_st && !startup_times[STARTUP_FIRST_AUDIO_CALLBACK] && now - startup_origin < STARTUP_REPORT_TIMEOUT)
+    return;
+  startup_reported = 1;
+
+  av_strlcpy(line, "startup:", sizeof(line));
+  for (int i = 0; i < STARTUP_NB; i++) {
+    int64_t t = startup_times[i];
+    if (t)
+      av_strlcatf(line, sizeof(line), " %s=%.1f", startup_names[i], (t - startup_origin) / 1000.0);
+    else
+      av_strlcatf(line, sizeof(line), " %s=-", startup_names[i]);
+  }
+  av_log(NULL, AV_LOG_INFO, "%s probe_cache=%s\n", line, is->probe_cache_hit ? "hit" : "miss");
+}
+
 /* options specified by the user */
 static AVInputFormat *file_iformat;   // 310
 static const char *input_filename;    // 311
+static int seamless_loop;             // -loop: wrap forever without flush or pause
+static int kfindex_sidecar;           // -kfindex_sidecar: keyframe index next to the media, not in the cache directory
+static const char *vfilters;          // -vf: filter graph between the video decoder and pictq
+static int deinterlace = 1;           // -nodeint: show interlaced pictures as they are
+static int autorotate = 1;            // -noautorotate: ignore the display matrix
+static int spherical = 1;             // -no360: start 360 video as the flat equirectangular picture
+static const char *afilters;          // -af: filter graph between the audio decoder and sampq
+static int subtitle_disable;          // -sn: do not open the subtitle stream
+
+#define AUDIO_FILTER_STATS_FRAMES 1000
+
+/* stereo 3D pictures: as packed, one eye, or a red/cyan anaglyph; -stereo and the 3 key */
+enum StereoMode { STEREO_MODE_BOTH, STEREO_MODE_LEFT, STEREO_MODE_RIGHT, STEREO_MODE_ANAGLYPH, STEREO_MODE_NB };
+static const char *stereo_mode_names[STEREO_MODE_NB] = { "both", "left", "right", "anaglyph" };
+static int stereo_mode = STEREO_MODE_BOTH;
+
+/* playback speed: clocks run at this rate, audio is time-stretched to it in the filter graph */
+#define PLAYBACK_SPEED_MIN  0.5
+#define PLAYBACK_SPEED_MAX  4.0
+#define ATEMPO_MAX          2.0   // one atempo instance covers 0.5 - 2.0
+
+static const double playback_speeds[] = { 0.5, 0.75, 1.0, 1.25, 1.5, 1.75, 2.0, 2.5, 3.0, 4.0 };
+
+static std::atomic<double> playback_speed(1.0);   // -speed, [ and ] keys
+
+/* -mosaic: every input plays at once, tiled into the one window and renderer */
+#define MOSAIC_MAX          64
+#define MOSAIC_STATS_PERIOD 10000000
+
+static VideoState *mosaic[MOSAIC_MAX];
+static int mosaic_count;
+static int64_t mosaic_stats_start;
+static int64_t mosaic_stats_cpu;
+static int64_t mosaic_display_time;
+static int mosaic_presents;
+
+static SDL_Window *window;            // 362
+static SDL_Renderer *renderer;
+static int renderer_yuv = 1;          // the renderer has YUV textures, otherwise everything becomes BGRA
+static int renderer_probed;           // renderer_yuv is final; convert_thread waits for it under renderer_mutex
+static SDL_mutex *renderer_mutex;
+static SDL_cond *renderer_cond;
+static SDL_AudioDeviceID audio_dev;
+
+#define TEXTURE_POOL_BUDGET (256 * 1024 * 1024)
+
+static TexturePool texture_pool;
+
+/* bytes handed to the texture per frame, and how many frames had rows aligned for a single copy */
+#define UPLOAD_STATS_FRAMES 250
+
+static int64_t upload_bytes;
+static int upload_frames;
+static int upload_aligned;
+
+/* frames without a matching texture format are converted in horizontal slices across a pool */
+#define CONVERT_MIN_ROWS      64    // smaller slices cost more to hand out than to convert
+#define CONVERT_STATS_FRAMES  250
+
+static int convert_threads = -1;      // -convert_threads N, including the display thread; -1 = cpu count
+static SlicePool *convert_pool;
+static std::atomic<int64_t> convert_time;   // from the display thread or every convert_thread
+static std::atomic<int> convert_frames;
+
+/* 360 view rendering on convert_pool, display thread only */
+static int64_t viewport_time;
+static int viewport_frames;
+static int viewport_rebuilds;
+
+typedef struct AnaglyphJob {
+  const AVStereo3D *s3d;
+  const AVFrame *rgb;
+  uint8_t *pixels;
+  int pitch;
+  int ret[CONVERT_MAX_SLICES];
+} AnaglyphJob;
+
+typedef struct ViewportJob {
+  const Viewport *vp;
+  const AVFrame *frame;
+  uint8_t *data[3];
+  int linesize[3];
+  int ret[CONVERT_MAX_SLICES];
+} ViewportJob;
+
+/* -convert_stage: convert and scale to the window ahead of the display, see convert_thread */
+#define CONVERT_QUEUE_SIZE    3
+
+static int convert_stage;
+
+typedef struct ConvertJob {
+  AVFrame *frame;
+  uint8_t *data[4];                 // BGRA, or the yuv420p planes when dithering
+  int linesize[4];
+  int kernels;                      // yuv2rgb can take it, sws otherwise
+  struct SwsContext **sws_ctx;      // CONVERT_MAX_SLICES of them
+  const TonemapContext *tonemap;    // HDR source, takes precedence over all others
+  int dither;                       // SDR 10/12-bit source to 8-bit yuv420p
+  int ret[CONVERT_MAX_SLICES];
+} ConvertJob;
+
+#define FF_NEXT_EVENT   (SDL_USEREVENT + 3)
+
+/* the VideoState sdl_audio_callback pulls from; moves to the next playlist item at its boundary */
+static std::atomic<VideoState *> audio_owner;
+
+/* what the open device plays, for playlist items that share it */
+static struct AudioParams audio_dev_params;
+static int audio_dev_buf_size;
+
+static const char **playlist;
+static int playlist_len;
+static int playlist_pos;
+
+/* audio device opened speculatively while read_thread probes, see audio_open */
+#define AUDIO_PREWARM_FREQ      48000
+#define AUDIO_PREWARM_CHANNELS  2
+
+static SDL_Thread *audio_prewarm_tid;
+static SDL_AudioDeviceID audio_prewarm_dev;
+static SDL_AudioSpec audio_prewarm_spec;
 
 static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub)    // 585
 {
@@ -36,167 +331,2262 @@ static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub)
     if (pkt.data == flush_pkt.data) {
 
     }
-    else {
-      if (d->avctx-codec_type == AVMEDIA_TYPE_SUBTITLE) {
+    else {
+      if (d->avctx->codec_type == AVMEDIA_TYPE_SUBTITLE) {
+        // 6-4. subtitles still decode a packet at a time, straight into the subpq entry
+        int got_frame = 0;
+        ret = avcodec_decode_subtitle2(d->avctx, sub, &got_frame, &pkt);
+        if (ret < 0) {
+          ret = AVERROR(EAGAIN);
+        }
+        else {
+          if (got_frame && !pkt.data) {
+            d->packet_pending = 1;
+            av_packet_move_ref(&d->pkt, &pkt);
+          }
+          ret = got_frame ? 0 : (pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
+        }
+      }
+      else {
+        // 6-2. decode send-receive pair
+        if (avcodec_send_packet(d->avctx, &pkt) == AVERROR(EAGAIN)) {
+
+        }
+      }
+    }
+  }
+}
+
+static void frame_queue_push(FrameQueue *f)       // 772
+{
+
+}
+
+static int frame_queue_put_picture(FrameQueue *fq, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
+{
+  Frame *vp;
+
+  if (!(vp = frame_queue_peek_writable(fq)))
+    return -1;
+
+  vp->sar = src_frame->sample_aspect_ratio;
+  vp->uploaded = 0;
+
+  vp->width = src_frame->width;
+  vp->height = src_frame->height;
+  vp->format = src_frame->format;
+
+  vp->pts = pts;
+  vp->duration = duration;
+  vp->pos = pos;
+  vp->serial = serial;
+
+  // 7-1. move decoded frame to frame queue
+  av_frame_move_ref(vp->frame, src_frame);
+  frame_queue_push(fq);
+  return 0;
+}
+
+static void convert_slice(void *arg, int slice, int nb_slices)
+{
+  ConvertJob *job = (ConvertJob *)arg;
+  AVFrame *frame = job->frame;
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+
+  // cut on chroma row (and bayer pattern) boundaries so every slice is a complete picture of its own
+  int align = FFMAX(1 << desc->log2_chroma_h, desc->flags & AV_PIX_FMT_FLAG_BAYER ? 2 : 1);
+  int y_start = frame->height * slice / nb_slices & ~(align - 1);
+  int y_end = slice == nb_slices - 1 ? frame->height : frame->height * (slice + 1) / nb_slices & ~(align - 1);
+  int h = y_end - y_start;
+  if (h <= 0)
+    return;
+
+  if (job->tonemap) {
+    job->ret[slice] = tonemap_convert(job->tonemap, frame, job->data[0], job->linesize[0], y_start, y_end);
+    return;
+  }
+  if (job->dither) {
+    job->ret[slice] = dither_convert(frame, job->data, job->linesize, y_start, y_end);
+    return;
+  }
+  if (job->kernels) {
+    job->ret[slice] = yuv2rgb_convert(frame, job->data[0], job->linesize[0], AV_PIX_FMT_BGRA, y_start, y_end);
+    return;
+  }
+
+  // sws needs slices in order within one context, so each slice gets its own and is
+  // scaled as a separate image; chroma at the cut is clamped rather than interpolated
+  struct SwsContext **ctx = &job->sws_ctx[slice];
+  *ctx = sws_getCachedContext(*ctx, frame->width, h, (enum AVPixelFormat)frame->format, frame->width, h,
+                              AV_PIX_FMT_BGRA, sws_flags, NULL, NULL, NULL);
+  if (!*ctx) {
+    av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+    job->ret[slice] = -1;
+    return;
+  }
+
+  const uint8_t *src[4];
+  int pal = desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL);
+  for (int i = 0; i < 4; i++) {
+    int shift = (i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ? desc->log2_chroma_h : 0;
+    if (!frame->data[i] || (pal && i == 1))
+      src[i] = frame->data[i];     // palette, not rows
+    else
+      src[i] = frame->data[i] + (ptrdiff_t)frame->linesize[i] * (y_start >> shift);
+  }
+  uint8_t *dst[4] = { job->data[0] + (ptrdiff_t)job->linesize[0] * y_start };
+  int dst_linesize[4] = { job->linesize[0] };
+  sws_scale(*ctx, src, frame->linesize, 0, h, dst, dst_linesize);
+}
+
+/* run with -convert_threads 1, 2, 4, ... to compare the speedup per thread count */
+static void convert_log_stats(const AVFrame *frame, enum AVPixelFormat dst_fmt, int64_t elapsed, int nb_slices,
+                              const char *kernel)
+{
+  int64_t time = convert_time += elapsed;
+  int frames = ++convert_frames;
+  if (frames != CONVERT_STATS_FRAMES)
+    return;
+  av_log(NULL, AV_LOG_INFO, "convert: %dx%d %s -> %s, %.2f ms/frame over %d frames, %d slices on %d threads (%s)\n",
+         frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat)frame->format),
+         av_get_pix_fmt_name(dst_fmt), time / 1000.0 / frames, frames, nb_slices, slicepool_threads(convert_pool) + 1,
+         kernel);
+  convert_time = 0;
+  convert_frames = 0;
+}
+
+/* what convert_frame makes of a picture: SDR 10/12-bit 4:2:0 is dithered to yuv420p, the rest becomes BGRA */
+static enum AVPixelFormat convert_dst_format(const AVFrame *frame)
+{
+  if (renderer_yuv && dither_supported((enum AVPixelFormat)frame->format) && !tonemap_supported(frame))
+    return AV_PIX_FMT_YUV420P;
+  return AV_PIX_FMT_BGRA;
+}
+
+/**
+ *  convert frame to convert_dst_format at the same size into data, in horizontal
+ *  slices, one per thread of convert_pool plus the caller. Common yuv layouts go
+ *  through our SIMD kernels, everything else through swscale with a context per
+ *  slice. PQ / HLG pictures are tone mapped to SDR when a tonemap context is given
+ */
+static int convert_frame(AVFrame *frame, uint8_t *const data[4], const int linesize[4], struct SwsContext **sws_ctx,
+                         TonemapContext *tonemap)
+{
+  enum AVPixelFormat dst_fmt = convert_dst_format(frame);
+  char kernel[64];
+  int64_t start = av_gettime_relative();
+  int ret = 0;
+  ConvertJob job = {};
+
+  job.frame = frame;
+  for (int i = 0; i < 4; i++) {
+    job.data[i] = data[i];
+    job.linesize[i] = linesize[i];
+  }
+  job.dither = dst_fmt == AV_PIX_FMT_YUV420P;
+  job.kernels = yuv2rgb_supported((enum AVPixelFormat)frame->format, AV_PIX_FMT_BGRA);
+  job.sws_ctx = sws_ctx;
+  if (tonemap && tonemap_supported(frame) && tonemap_update(tonemap, frame) >= 0)
+    job.tonemap = tonemap;
+  int nb_slices = av_clip(frame->height / CONVERT_MIN_ROWS, 1, FFMIN(slicepool_threads(convert_pool) + 1, CONVERT_MAX_SLICES));
+  slicepool_run(convert_pool, convert_slice, &job, nb_slices);
+  for (int i = 0; i < nb_slices; i++)
+    ret = FFMIN(ret, job.ret[i]);
+
+  if (job.tonemap)
+    snprintf(kernel, sizeof(kernel), "tonemap %s", tonemap_kernel_name());
+  else if (job.dither)
+    snprintf(kernel, sizeof(kernel), "dither %s", dither_kernel_name());
+  else
+    snprintf(kernel, sizeof(kernel), "%s", job.kernels ? yuv2rgb_kernel_name() : "swscale");
+  convert_log_stats(frame, dst_fmt, av_gettime_relative() - start, nb_slices, kernel);
+  return ret;
+}
+
+/**
+ *  the texture format a picture goes into as it is; SDL_PIXELFORMAT_UNKNOWN when
+ *  it has to be converted, which includes every YUV layout on a renderer without
+ *  YUV textures (software or GLES2 without the extensions, some D3D drivers)
+ */
+static void texture_format(int format, Uint32 *sdl_pix_fmt, SDL_BlendMode *sdl_blendmode)
+{
+  get_sdl_pix_fmt_and_blendmode(format, sdl_pix_fmt, sdl_blendmode);
+  if (!renderer_yuv && SDL_ISPIXELFORMAT_FOURCC(*sdl_pix_fmt))
+    *sdl_pix_fmt = SDL_PIXELFORMAT_UNKNOWN;
+}
+
+/**
+ *  at renderer creation: whether it lists any YUV texture format. The renderer
+ *  is created while the first stream probes, so threads other than the display
+ *  one wait in renderer_wait before they read renderer_yuv
+ */
+static void renderer_probe_formats(void)
+{
+  SDL_RendererInfo info;
+  int yuv = 1;
+
+  if (SDL_GetRendererInfo(renderer, &info) >= 0) {
+    yuv = 0;
+    for (Uint32 i = 0; i < info.num_texture_formats; i++)
+      if (SDL_ISPIXELFORMAT_FOURCC(info.texture_formats[i]))
+        yuv = 1;
+    av_log(NULL, yuv ? AV_LOG_VERBOSE : AV_LOG_INFO, "renderer %s: %s\n", info.name,
+           yuv ? "YUV textures" : "no YUV textures, converting to BGRA");
+  }
+
+  SDL_LockMutex(renderer_mutex);
+  renderer_yuv = yuv;
+  renderer_probed = 1;
+  SDL_CondBroadcast(renderer_cond);
+  SDL_UnlockMutex(renderer_mutex);
+}
+
+static void renderer_wait(void)
+{
+  SDL_LockMutex(renderer_mutex);
+  while (!renderer_probed)
+    SDL_CondWait(renderer_cond, renderer_mutex);
+  SDL_UnlockMutex(renderer_mutex);
+}
+
+static void upload_log_stats(const AVFrame *frame, int64_t bytes)
+{
+  int aligned = 1;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->data[i]; i++)
+    aligned &= !((uintptr_t)frame->data[i] % FRAMEPOOL_ALIGN) && !(frame->linesize[i] % FRAMEPOOL_ALIGN);
+
+  upload_bytes += bytes;
+  upload_aligned += aligned;
+  if (++upload_frames < UPLOAD_STATS_FRAMES)
+    return;
+  av_log(NULL, AV_LOG_INFO, "upload: %dx%d %s, %.1f KiB copied/frame, %d%% with %d-byte aligned rows\n",
+         frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat)frame->format),
+         upload_bytes / 1024.0 / upload_frames, upload_aligned * 100 / upload_frames, FRAMEPOOL_ALIGN);
+  upload_bytes = 0;
+  upload_frames = 0;
+  upload_aligned = 0;
+}
+
+static int upload_texture(SDL_Texture *tex, AVFrame *frame, struct SwsContext **img_convert_ctx,
+                          TonemapContext *tonemap)  // 900
+{
+  int ret = 0;
+  Uint32 sdl_pix_fmt;
+  SDL_BlendMode sdl_blendmode;
+  texture_format(frame->format, &sdl_pix_fmt, &sdl_blendmode);
+
+  switch (sdl_pix_fmt) {
+    case SDL_PIXELFORMAT_UNKNOWN: {
+      /* no texture for this layout: convert to ARGB8888 (BGRA in memory), or dither
+       * high bit depth to IYUV, straight into the texture */
+      uint8_t *pixels[4] = { NULL };
+      int pitch[4] = { 0 };
+      if (SDL_LockTexture(tex, NULL, (void **)pixels, pitch))
+        return -1;
+
+      if (convert_dst_format(frame) == AV_PIX_FMT_YUV420P) {
+        // a locked IYUV texture is its planes back to back, chroma at half the pitch
+        pitch[1] = pitch[2] = (pitch[0] + 1) / 2;
+        pixels[1] = pixels[0] + (ptrdiff_t)pitch[0] * frame->height;
+        pixels[2] = pixels[1] + (ptrdiff_t)pitch[1] * AV_CEIL_RSHIFT(frame->height, 1);
+      }
+      ret = convert_frame(frame, pixels, pitch, img_convert_ctx, tonemap);
+      SDL_UnlockTexture(tex);
+      break;
+    }
+    case SDL_PIXELFORMAT_IYUV:
+      if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
+        ret = SDL_UpdateYUVTexture(tex, NULL, frame->data[0], frame->linesize[0],
+                                              frame->data[1], frame->linesize[1],
+                                              frame->data[2], frame->linesize[2]);
+      }
+      else if (frame->linesize[0] < 0 && frame->linesize[1] < 0 && frame->linesize[2] < 0) {
+        ret = SDL_UpdateYUVTexture(tex, NULL, frame->data[0] + frame->linesize[0] * (frame->height                    - 1), -frame->linesize[0],
+                                              frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[1],
+                                              frame->data[2] + frame->linesize[2] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[2]);
+      }
+      else {
+        av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
+        return -1;
+      }
+      break;
+    default:
+      if (frame->linesize[0] < 0) {
+        ret = SDL_UpdateTexture(tex, NULL, frame->data[0] + frame->linesize[0] * (frame->height - 1), -frame->linesize[0]);
+      }
+      else {
+        ret = SDL_UpdateTexture(tex, NULL, frame->data[0], frame->linesize[0]);
+      }
+      break;
+  }
+
+  // what went into the texture: the frame rows, or the picture converted into it
+  if (ret >= 0)
+    upload_log_stats(frame, av_image_get_buffer_size(sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? convert_dst_format(frame) :
+                     (enum AVPixelFormat)frame->format, frame->width, frame->height, 1));
+  return ret;
+}
+
+/* convert the picture to be shown into is->vid_texture, once per frame */
+/* the view can be drawn from this picture: 8-bit 4:2:0 as it is, SDR 10/12-bit once dithered */
+static int viewport_usable(VideoState *is, const AVFrame *frame)
+{
+  // the sizes viewport_update accepts; anything else is shown flat
+  return is->viewport_on && renderer_yuv && is->width >= 2 && is->height >= 2 &&
+         frame->width >= 4 && frame->height >= 4 && frame->width <= 0xffff && frame->height <= 0xffff &&
+         (viewport_supported((enum AVPixelFormat)frame->format) || convert_dst_format(frame) == AV_PIX_FMT_YUV420P);
+}
+
+static void viewport_slice(void *arg, int slice, int nb_slices)
+{
+  ViewportJob *job = (ViewportJob *)arg;
+  int h = job->vp->dst_h;
+
+  // even rows, so each slice owns its chroma rows
+  int y_start = h * slice / nb_slices & ~1;
+  int y_end = slice == nb_slices - 1 ? h : h * (slice + 1) / nb_slices & ~1;
+  if (y_end > y_start)
+    job->ret[slice] = viewport_render(job->vp, job->frame, job->data, job->linesize, y_start, y_end);
+}
+
+static void viewport_log_stats(const AVFrame *frame, const Viewport *view, int64_t elapsed)
+{
+  viewport_time += elapsed;
+  viewport_rebuilds += view->rebuild;
+  if (++viewport_frames < CONVERT_STATS_FRAMES)
+    return;
+  av_log(NULL, AV_LOG_INFO, "viewport: %dx%d %s -> %dx%d, %.2f ms/frame over %d frames, %d table rebuilds (%s)\n",
+         frame->width, frame->height, av_get_pix_fmt_name((enum AVPixelFormat)frame->format), view->dst_w, view->dst_h,
+         viewport_time / 1000.0 / viewport_frames, viewport_frames, viewport_rebuilds, viewport_kernel_name());
+  viewport_time = 0;
+  viewport_frames = 0;
+  viewport_rebuilds = 0;
+}
+
+/* a reusable frame for an intermediate picture, reallocated when the size or format changes */
+static AVFrame *scratch_frame(AVFrame **pframe, int format, int width, int height)
+{
+  AVFrame *frame = *pframe;
+  if (!frame && !(frame = *pframe = av_frame_alloc()))
+    return NULL;
+  if (frame->format != format || frame->width != width || frame->height != height) {
+    av_frame_unref(frame);
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, FRAMEPOOL_ALIGN) < 0)
+      return NULL;
+  }
+  return frame;
+}
+
+/**
+ *  render the view of frame into tex, an IYUV texture the size of the window
+ *  (or tile), in slices on convert_pool. The remap tables are rebuilt by the
+ *  same slices when the view or a size changed since the last picture
+ */
+static int viewport_upload(VideoState *is, SDL_Texture *tex, AVFrame *frame)
+{
+  int64_t start = av_gettime_relative();
+  ViewportJob job = {};
+  uint8_t *pixels = NULL;
+  int pitch = 0;
+  int ret;
+
+  if (!viewport_supported((enum AVPixelFormat)frame->format)) {
+    AVFrame *yuv = scratch_frame(&is->viewport_src, AV_PIX_FMT_YUV420P, frame->width, frame->height);
+    if (!yuv)
+      return AVERROR(ENOMEM);
+    if ((ret = convert_frame(frame, yuv->data, yuv->linesize, is->img_convert_ctx, NULL)) < 0)
+      return ret;
+    frame = yuv;
+  }
+
+  if ((ret = viewport_update(&is->viewport, frame, is->width, is->height)) < 0)
+    return ret;
+  if (SDL_LockTexture(tex, NULL, (void **)&pixels, &pitch))
+    return -1;
+
+  // a locked IYUV texture is its planes back to back, chroma at half the pitch
+  job.vp = &is->viewport;
+  job.frame = frame;
+  job.data[0] = pixels;
+  job.linesize[0] = pitch;
+  job.linesize[1] = job.linesize[2] = (pitch + 1) / 2;
+  job.data[1] = job.data[0] + (ptrdiff_t)job.linesize[0] * is->height;
+  job.data[2] = job.data[1] + (ptrdiff_t)job.linesize[1] * AV_CEIL_RSHIFT(is->height, 1);
+  int nb_slices = av_clip(is->height / CONVERT_MIN_ROWS, 1, FFMIN(slicepool_threads(convert_pool) + 1, CONVERT_MAX_SLICES));
+  slicepool_run(convert_pool, viewport_slice, &job, nb_slices);
+  SDL_UnlockTexture(tex);
+
+  ret = 0;
+  for (int i = 0; i < nb_slices; i++)
+    ret = FFMIN(ret, job.ret[i]);
+  viewport_log_stats(frame, &is->viewport, av_gettime_relative() - start);
+  return ret;
+}
+
+/**
+ *  packing of a picture shown other than as is: its own side data, else the
+ *  stream's. Rows stored bottom up put the bottom eye of the texture on top
+ */
+static int video_stereo3d(VideoState *is, const AVFrame *frame, AVStereo3D *s3d)
+{
+  AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_STEREO3D);
+
+  if (stereo_mode == STEREO_MODE_BOTH || viewport_usable(is, frame))
+    return 0;
+  *s3d = sd ? *(const AVStereo3D *)sd->data : is->stereo3d;
+  return stereo_supported(s3d);
+}
+
+static void anaglyph_slice(void *arg, int slice, int nb_slices)
+{
+  AnaglyphJob *job = (AnaglyphJob *)arg;
+  StereoRect eye = stereo_eye_rect(job->s3d, job->rgb->width, job->rgb->height, 0);
+  int y_start = eye.h * slice / nb_slices;
+  int y_end = eye.h * (slice + 1) / nb_slices;
+
+  job->ret[slice] = stereo_anaglyph(job->s3d, job->rgb->data[0], job->rgb->linesize[0], job->rgb->width, job->rgb->height,
+                                    job->pixels, job->pitch, y_start, y_end);
+}
+
+/**
+ *  the anaglyph of frame into tex, an ARGB8888 texture the size of one eye.
+ *  The packed picture goes to BGRA through convert_frame (10/12-bit dithered
+ *  first), then both eyes are blended in slices on convert_pool
+ */
+static int anaglyph_upload(VideoState *is, SDL_Texture *tex, AVFrame *frame, const AVStereo3D *s3d)
+{
+  AnaglyphJob job = {};
+  AVFrame *rgb = frame;
+  int ret;
+
+  if (frame->format != AV_PIX_FMT_BGRA) {
+    if (convert_dst_format(frame) == AV_PIX_FMT_YUV420P) {
+      AVFrame *yuv = scratch_frame(&is->stereo_yuv, AV_PIX_FMT_YUV420P, frame->width, frame->height);
+      if (!yuv)
+        return AVERROR(ENOMEM);
+      if ((ret = convert_frame(frame, yuv->data, yuv->linesize, is->img_convert_ctx, NULL)) < 0)
+        return ret;
+      yuv->colorspace = frame->colorspace;   // picks the BGRA conversion matrix
+      yuv->color_range = frame->color_range;
+      frame = yuv;
+    }
+    if (!(rgb = scratch_frame(&is->stereo_rgb, AV_PIX_FMT_BGRA, frame->width, frame->height)))
+      return AVERROR(ENOMEM);
+    if ((ret = convert_frame(frame, rgb->data, rgb->linesize, is->img_convert_ctx, &is->tonemap)) < 0)
+      return ret;
+  }
+
+  job.s3d = s3d;
+  job.rgb = rgb;
+  if (SDL_LockTexture(tex, NULL, (void **)&job.pixels, &job.pitch))
+    return -1;
+  StereoRect eye = stereo_eye_rect(s3d, rgb->width, rgb->height, 0);
+  int nb_slices = av_clip(eye.h / CONVERT_MIN_ROWS, 1, FFMIN(slicepool_threads(convert_pool) + 1, CONVERT_MAX_SLICES));
+  slicepool_run(convert_pool, anaglyph_slice, &job, nb_slices);
+  SDL_UnlockTexture(tex);
+
+  ret = 0;
+  for (int i = 0; i < nb_slices; i++)
+    ret = FFMIN(ret, job.ret[i]);
+  return ret;
+}
+
+static int video_image_upload(VideoState *is)
+{
+  AVStereo3D s3d;
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+  Uint32 sdl_pix_fmt;
+  SDL_BlendMode sdl_blendmode;
+
+  // 360 video: a new picture, or the same one seen from where the mouse turned the view
+  if (viewport_usable(is, vp->frame)) {
+    if (vp->uploaded && is->viewport_shown &&
+        !viewport_stale(&is->viewport, vp->frame->width, vp->frame->height, is->width, is->height))
+      return 0;
+    SDL_Texture *back = texpool_acquire(&texture_pool, SDL_PIXELFORMAT_IYUV, is->width, is->height, SDL_BLENDMODE_NONE);
+    if (!back)
+      return -1;
+    int ret = viewport_upload(is, back, vp->frame);
+    if (ret >= 0) {
+      texpool_release(&texture_pool, is->vid_texture);
+      is->vid_texture = back;
+      is->viewport_shown = 1;
+      is->anaglyph_shown = 0;
+      vp->uploaded = 1;
+      vp->flip_v = 0;
+      return 0;
+    }
+    // no view of this picture: show it flat rather than nothing, o tries again
+    texpool_release(&texture_pool, back);
+    av_log(NULL, AV_LOG_WARNING, "360 view unavailable (error %d), shown flat\n", ret);
+    is->viewport_on = 0;
+  }
+  // the texture holds a view of the picture rather than the picture
+  if (is->viewport_shown) {
+    is->viewport_shown = 0;
+    vp->uploaded = 0;
+  }
+
+  // stereo 3D anaglyph: a blend of both eyes, the only mode that is not a source rectangle
+  if (stereo_mode == STEREO_MODE_ANAGLYPH && video_stereo3d(is, vp->frame, &s3d)) {
+    if (vp->uploaded && is->anaglyph_shown)
+      return 0;
+    StereoRect eye = stereo_eye_rect(&s3d, vp->frame->width, vp->frame->height, 0);
+    SDL_Texture *back = texpool_acquire(&texture_pool, SDL_PIXELFORMAT_ARGB8888, eye.w, eye.h, SDL_BLENDMODE_NONE);
+    if (!back)
+      return -1;
+    if (anaglyph_upload(is, back, vp->frame, &s3d) < 0) {
+      texpool_release(&texture_pool, back);
+      return -1;
+    }
+    texpool_release(&texture_pool, is->vid_texture);
+    is->vid_texture = back;
+    is->anaglyph_shown = 1;
+    vp->uploaded = 1;
+    vp->flip_v = 0;     // rows come out upright whatever the frame's linesize
+    return 0;
+  }
+
+  if (is->anaglyph_shown) {
+    is->anaglyph_shown = 0;
+    vp->uploaded = 0;
+  }
+
+  if (!vp->uploaded) {
+    // write into a back texture from the pool, never into the one on screen;
+    // the front one goes back to the pool and becomes the next back texture
+    texture_format(vp->frame->format, &sdl_pix_fmt, &sdl_blendmode);
+    // no texture for this layout: converted in upload_texture, see convert_dst_format;
+    // the conversion writes rows upright, only a copied bottom-up frame needs the flip
+    int converted = sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN;
+    if (converted)
+      sdl_pix_fmt = convert_dst_format(vp->frame) == AV_PIX_FMT_YUV420P ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_ARGB8888;
+    SDL_Texture *back = texpool_acquire(&texture_pool, sdl_pix_fmt, vp->frame->width, vp->frame->height, sdl_blendmode);
+    if (!back)
+      return -1;
+    if (upload_texture(back, vp->frame, is->img_convert_ctx, &is->tonemap) < 0) {
+      texpool_release(&texture_pool, back);
+      return -1;
+    }
+    texpool_release(&texture_pool, is->vid_texture);
+    is->vid_texture = back;
+    vp->uploaded = 1;
+    vp->flip_v = !converted && vp->frame->linesize[0] < 0;
+  }
+  return 0;
+}
+
+/**
+ *  calculate_display_rect for a picture shown turned by rotation degrees. The
+ *  rect is where the unrotated texture goes: SDL_RenderCopyEx turns it about
+ *  its centre into the box calculated for the rotated picture
+ */
+static void calculate_rotated_display_rect(SDL_Rect *rect, int xleft, int ytop, int scr_width, int scr_height,
+                                           int pic_width, int pic_height, AVRational pic_sar, int rotation)
+{
+  SDL_Rect box;
+
+  if (rotation != 90 && rotation != 270) {
+    calculate_display_rect(rect, xleft, ytop, scr_width, scr_height, pic_width, pic_height, pic_sar);
+    return;
+  }
+  calculate_display_rect(&box, xleft, ytop, scr_width, scr_height, pic_height, pic_width,
+                         pic_sar.num ? av_inv_q(pic_sar) : pic_sar);
+  rect->w = box.h;
+  rect->h = box.w;
+  rect->x = box.x + (box.w - box.h) / 2;
+  rect->y = box.y + (box.h - box.w) / 2;
+}
+
+/* the subpq head, once the picture on screen has reached its start time */
+static Frame *subtitle_current(VideoState *is)
+{
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+  Frame *sp;
+
+  if (!is->subtitle_st || frame_queue_nb_remaining(&is->subpq) <= 0)
+    return NULL;
+  sp = frame_queue_peek(&is->subpq);
+  if (vp->pts < sp->pts + sp->sub.start_display_time / 1000.0)
+    return NULL;
+  return sp;
+}
+
+static void subtitle_release(VideoState *is)
+{
+  for (unsigned i = 0; i < is->sub_nb_textures; i++)
+    texpool_release(&texture_pool, is->sub_textures[i]);
+  av_freep(&is->sub_textures);
+  is->sub_nb_textures = 0;
+}
+
+/**
+ *  DVB / PGS / DVD rects to ARGB8888 textures, once per subtitle. A PAL8 palette
+ *  entry already is an ARGB8888 pixel, so this is one lookup per sample rather
+ *  than ffplay's swscale into one picture sized texture. Each rect keeps its own
+ *  texture and every picture until the subtitle expires only costs render copies
+ */
+static int subtitle_upload(VideoState *is)
+{
+  Frame *sp = subtitle_current(is);
+  int64_t bytes = 0;
+
+  if (!sp || sp->uploaded)
+    return 0;
+  subtitle_release(is);
+  // rects are placed on the picture the decoder knows of, or on the coded video picture
+  if (!sp->width || !sp->height) {
+    sp->width = is->video_st->codecpar->width;
+    sp->height = is->video_st->codecpar->height;
+  }
+  if (sp->sub.num_rects &&
+      !(is->sub_textures = (SDL_Texture **)av_mallocz_array(sp->sub.num_rects, sizeof(*is->sub_textures))))
+    return AVERROR(ENOMEM);
+  is->sub_nb_textures = sp->sub.num_rects;
+
+  for (unsigned i = 0; i < sp->sub.num_rects; i++) {
+    AVSubtitleRect *r = sp->sub.rects[i];
+    uint32_t pal[256] = { 0 };    // indices past nb_colors come out transparent
+    uint8_t *pixels;
+    int pitch;
+
+    if (r->type != SUBTITLE_BITMAP || r->w <= 0 || r->h <= 0 || !r->data[0] || !r->data[1])
+      continue;
+    SDL_Texture *tex = texpool_acquire(&texture_pool, SDL_PIXELFORMAT_ARGB8888, r->w, r->h, SDL_BLENDMODE_BLEND);
+    if (!tex)
+      return -1;
+    is->sub_textures[i] = tex;
+    if (SDL_LockTexture(tex, NULL, (void **)&pixels, &pitch) < 0)
+      return -1;
+    memcpy(pal, r->data[1], FFMIN(FFMAX(r->nb_colors, 0), 256) * sizeof(*pal));
+    for (int y = 0; y < r->h; y++) {
+      const uint8_t *src = r->data[0] + (ptrdiff_t)y * r->linesize[0];
+      uint32_t *dst = (uint32_t *)(pixels + (ptrdiff_t)y * pitch);
+      for (int x = 0; x < r->w; x++)
+        dst[x] = pal[src[x]];
+    }
+    SDL_UnlockTexture(tex);
+    bytes += (int64_t)r->w * r->h * 4;
+  }
+  sp->uploaded = 1;
+  av_log(NULL, AV_LOG_DEBUG, "subtitle: %u rects, %.1f KB uploaded, kept until it expires\n",
+         sp->sub.num_rects, bytes / 1024.0);
+  return 0;
+}
+
+/**
+ *  rects scaled from the subtitle's picture onto the box the picture is shown
+ *  in, kept upright. eye is the part of the vp picture shown, for one eye or the
+ *  anaglyph of a stereo picture; rects outside it belong to the other eye
+ */
+static void subtitle_draw(VideoState *is, const SDL_Rect *rect, int rotation, const StereoRect *eye)
+{
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+  Frame *sp = subtitle_current(is);
+  SDL_Rect box = *rect;
+
+  if (!sp || !sp->uploaded)
+    return;
+  if (rotation == 90 || rotation == 270) {
+    box.w = rect->h;
+    box.h = rect->w;
+    box.x = rect->x + (rect->w - rect->h) / 2;
+    box.y = rect->y + (rect->h - rect->w) / 2;
+  }
+
+  // the shown part of the picture, in the subtitle's coordinates
+  double ex = 0, ey = 0, ew = sp->width, eh = sp->height;
+  if (eye && vp->width && vp->height) {
+    ex = (double)eye->x * sp->width / vp->width;
+    ey = (double)eye->y * sp->height / vp->height;
+    ew = (double)eye->w * sp->width / vp->width;
+    eh = (double)eye->h * sp->height / vp->height;
+  }
+  double xratio = box.w / ew;
+  double yratio = box.h / eh;
+
+  for (unsigned i = 0; i < FFMIN(sp->sub.num_rects, is->sub_nb_textures); i++) {
+    AVSubtitleRect *r = sp->sub.rects[i];
+    if (!is->sub_textures[i])
+      continue;
+    if (r->x + r->w <= ex || r->x >= ex + ew || r->y + r->h <= ey || r->y >= ey + eh)
+      continue;
+    SDL_Rect dst = { box.x + (int)((r->x - ex) * xratio), box.y + (int)((r->y - ey) * yratio),
+                     (int)(r->w * xratio), (int)(r->h * yratio) };
+    SDL_RenderCopy(renderer, is->sub_textures[i], NULL, &dst);
+  }
+}
+
+/* the subtitle due now is not the one on screen: redraw even if the picture is the same */
+static int subtitle_changed(VideoState *is)
+{
+  Frame *sp = subtitle_current(is);
+
+  return sp != is->sub_shown || (sp && !sp->uploaded);
+}
+
+static void video_image_draw(VideoState *is)
+{
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+  SDL_Rect rect;
+  int flip = (vp->flip_v ? SDL_FLIP_VERTICAL : SDL_FLIP_NONE) | (is->rotation_hflip ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+
+  AVStereo3D s3d;
+
+  if (is->viewport_shown) {
+    rect = { is->xleft, is->ytop, is->width, is->height };
+    SDL_RenderCopy(renderer, is->vid_texture, NULL, &rect);
+    subtitle_draw(is, &rect, 0, NULL);
+    return;
+  }
+
+  // one eye of a stereo picture: the same texture, drawn from that eye's half
+  if (video_stereo3d(is, vp->frame, &s3d)) {
+    // the anaglyph is drawn in the left eye's place, which is also where its subtitles come from
+    StereoRect eye = stereo_eye_rect(&s3d, vp->width, vp->height, !is->anaglyph_shown && stereo_mode == STEREO_MODE_RIGHT);
+    StereoRect tex_eye = eye;
+    // a bottom-up texture has the top eye of a top-bottom picture in its lower half
+    if (vp->flip_v && s3d.type == AV_STEREO3D_TOPBOTTOM) {
+      AVStereo3D flipped = s3d;
+      flipped.flags ^= AV_STEREO3D_FLAG_INVERT;
+      tex_eye = stereo_eye_rect(&flipped, vp->width, vp->height, stereo_mode == STEREO_MODE_RIGHT);
+    }
+    SDL_Rect src = { tex_eye.x, tex_eye.y, tex_eye.w, tex_eye.h };
+    calculate_rotated_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, eye.w, eye.h,
+                                   stereo_eye_sar(&s3d, vp->width, vp->height, vp->sar), is->rotation);
+    SDL_RenderCopyEx(renderer, is->vid_texture, is->anaglyph_shown ? NULL : &src, &rect, is->rotation, NULL,
+                     (SDL_RendererFlip)flip);
+    subtitle_draw(is, &rect, is->rotation, &eye);
+    return;
+  }
+
+  calculate_rotated_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, vp->width, vp->height, vp->sar,
+                                 is->rotation);
+  SDL_RenderCopyEx(renderer, is->vid_texture, NULL, &rect, is->rotation, NULL, (SDL_RendererFlip)flip);
+  subtitle_draw(is, &rect, is->rotation, NULL);
+}
+
+/* the picture on screen is still the right one: nothing to convert, upload or present */
+static int video_unchanged(VideoState *is)
+{
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+
+  // a reused pictq slot starts with uploaded == 0, so index + serial is unambiguous
+  return is->show_mode == SHOW_MODE_VIDEO && vp->uploaded && !is->screen_damaged &&
+         is->shown_rindex == is->pictq.rindex && is->shown_serial == vp->serial;
+}
+
+static void video_mark_shown(VideoState *is)
+{
+  Frame *vp = frame_queue_peek_last(&is->pictq);
+
+  is->shown_rindex = is->pictq.rindex;
+  is->shown_serial = vp->serial;
+  is->sub_shown = subtitle_current(is);
+  is->screen_damaged = 0;
+}
+
+static void video_image_display(VideoState *is)   // 957
+{
+  if (video_image_upload(is) < 0)
+    return;
+  // a new subtitle is uploaded once, the pictures after it only draw its textures
+  subtitle_upload(is);
+  video_image_draw(is);
+}
+
+static void video_audio_display(VideoState *is)   // 1043
+{
+
+}
+
+/* bytes left in the file when the next loop pass gets opened */
+#define LOOP_PREPARE_BYTES  (4 * 1024 * 1024)
+
+/**
+ *  open a second context on the same file while the first one is still a few
+ *  MB from its end. A fresh context already sits at the start of the file, with
+ *  whatever find_stream_info read kept for av_read_frame. Runs on its own
+ *  thread so a slow open does not stall read_thread and drain the queues; it
+ *  only writes loop_ic / loop_failed, which read_thread reads after joining it
+ */
+static int loop_prepare_thread(void *arg)
+{
+  VideoState *is = (VideoState *)arg;
+  AVFormatContext *ic = NULL;
+  AVDictionary *opts = NULL;
+  ProbeCache *probe = NULL;
+  int64_t start = av_gettime_relative();
+  int err;
+
+  if (probecache_load(is->filename, &probe) >= 0)
+    probecache_open_options(probe, &opts);
+  err = avformat_open_input(&ic, is->filename, is->ic->iformat, &opts);
+  av_dict_free(&opts);
+  if (err >= 0 && !(probe && probecache_apply(probe, ic) >= 0))
+    err = avformat_find_stream_info(ic, NULL);
+  probecache_free(&probe);
+  if (err < 0) {
+    av_log(NULL, AV_LOG_WARNING, "%s: seamless loop unavailable, looping with a seek\n", is->filename);
+    avformat_close_input(&ic);
+    is->loop_failed = 1;
+    return err;
+  }
+
+  is->loop_ic = ic;
+  av_log(NULL, AV_LOG_VERBOSE, "loop: second context ready in %.1f ms\n", (av_gettime_relative() - start) / 1000.0);
+  return 0;
+}
+
+static void loop_prepare(VideoState *is)
+{
+  is->loop_tid = SDL_CreateThread(loop_prepare_thread, "loop_prepare", is);
+  if (!is->loop_tid) {
+    av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s, looping with a seek\n", SDL_GetError());
+    is->loop_failed = 1;
+  }
+}
+
+/* the prepared context, once loop_prepare_thread is done with it */
+static AVFormatContext *loop_prepared(VideoState *is)
+{
+  if (is->loop_tid) {
+    SDL_WaitThread(is->loop_tid, NULL);
+    is->loop_tid = NULL;
+  }
+  return is->loop_ic;
+}
+
+static void loop_close(VideoState *is)
+{
+  loop_prepared(is);
+  avformat_close_input(&is->loop_ic);
+  avformat_close_input(&is->loop_old_ic);
+}
+
+/**
+ *  -convert_stage: what the display would do to a picture before uploading it
+ *  happens here, ahead of its deadline. Layouts without a texture format become
+ *  BGRA and pictures are scaled to the size they are drawn at, so the display
+ *  is left with a plain texture update of a buffer no larger than the window
+ */
+static int convert_stage_picture(VideoState *is, AVFrame *src, AVFrame *dst)
+{
+  SDL_Rect rect;
+  Uint32 sdl_pix_fmt;
+  SDL_BlendMode sdl_blendmode;
+  AVFrame *scale_src = src;
+  int ret;
+
+  texture_format(src->format, &sdl_pix_fmt, &sdl_blendmode);
+  calculate_rotated_display_rect(&rect, 0, 0, is->width, is->height, src->width, src->height, src->sample_aspect_ratio,
+                                 is->rotation);
+
+  // shown as decoded already, or not shown at all while hidden or before the window has a size
+  if (SDL_AtomicGet(&is->video_hidden) || !is->width || !is->height || is->viewport_on || stereo_mode != STEREO_MODE_BOTH ||
+      (sdl_pix_fmt != SDL_PIXELFORMAT_UNKNOWN && rect.w == src->width && rect.h == src->height)) {
+    av_frame_move_ref(dst, src);
+    return 0;
+  }
+
+  dst->format = sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? convert_dst_format(src) : src->format;
+  dst->width = rect.w;
+  dst->height = rect.h;
+  if ((ret = av_frame_get_buffer(dst, FRAMEPOOL_ALIGN)) < 0 || (ret = av_frame_copy_props(dst, src)) < 0)
+    goto out;
+  dst->sample_aspect_ratio = av_make_q(1, 1);   // the display aspect is in the size now
+
+  if (rect.w == src->width && rect.h == src->height) {
+    ret = convert_frame(src, dst->data, dst->linesize, is->stage_convert_ctx, &is->stage_tonemap);
+  }
+  else {
+    // HDR is tone mapped at full size first, swscale only resizes the SDR picture
+    if (tonemap_supported(src)) {
+      AVFrame *tmp = is->stage_tonemapped;
+      if (!tmp && !(tmp = is->stage_tonemapped = av_frame_alloc())) {
+        ret = AVERROR(ENOMEM);
+        goto out;
+      }
+      if (tmp->width != src->width || tmp->height != src->height || !av_frame_is_writable(tmp)) {
+        av_frame_unref(tmp);
+        tmp->format = AV_PIX_FMT_BGRA;
+        tmp->width = src->width;
+        tmp->height = src->height;
+        if ((ret = av_frame_get_buffer(tmp, FRAMEPOOL_ALIGN)) < 0)
+          goto out;
+      }
+      if ((ret = convert_frame(src, tmp->data, tmp->linesize, is->stage_convert_ctx, &is->stage_tonemap)) < 0)
+        goto out;
+      scale_src = tmp;
+    }
+    is->stage_scale_ctx = sws_getCachedContext(is->stage_scale_ctx,
+        scale_src->width, scale_src->height, (enum AVPixelFormat)scale_src->format, rect.w, rect.h,
+        (enum AVPixelFormat)dst->format, sws_flags, NULL, NULL, NULL);
+    if (!is->stage_scale_ctx) {
+      av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+      ret = AVERROR(EINVAL);
+      goto out;
+    }
+    sws_scale(is->stage_scale_ctx, (const uint8_t * const *)scale_src->data, scale_src->linesize, 0, scale_src->height,
+              dst->data, dst->linesize);
+  }
+
+out:
+  if (ret < 0)
+    av_frame_unref(dst);
+  av_frame_unref(src);
+  return ret;
+}
+
+/* pictures from video_thread through convq, display-ready into pictq */
+static int convert_thread(void *arg)
+{
+  VideoState *is = (VideoState *)arg;
+  AVFrame *frame = av_frame_alloc();
+  Frame *in;
+  int ret = 0;
+
+  if (!frame)
+    return AVERROR(ENOMEM);
+
+  // the window and renderer may still be on their way, see main
+  renderer_wait();
+  while ((in = frame_queue_peek_readable(&is->convq))) {
+    double pts = in->pts;
+    double duration = in->duration;
+    int64_t pos = in->pos;
+    int serial = in->serial;
+
+    // queued before a seek: the display would drop it anyway, skip the work
+    if (serial != is->videoq.serial) {
+      frame_queue_next(&is->convq);
+      continue;
+    }
+    ret = convert_stage_picture(is, in->frame, frame);
+    frame_queue_next(&is->convq);
+    if (ret < 0)
+      break;
+    if (frame_queue_put_picture(&is->pictq, frame, pts, duration, pos, serial) < 0)
+      break;
+  }
+
+  av_frame_free(&frame);
+  return ret;
+}
+
+static int convert_stage_start(VideoState *is)
+{
+  is->convert_tid = SDL_CreateThread(convert_thread, "convert", is);
+  if (!is->convert_tid) {
+    av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+/* after decoder_abort: videoq is aborted, so both queues let the stage out wherever it waits */
+static void convert_stage_stop(VideoState *is)
+{
+  if (!is->convert_tid)
+    return;
+  frame_queue_signal(&is->convq);
+  frame_queue_signal(&is->pictq);
+  SDL_WaitThread(is->convert_tid, NULL);
+  is->convert_tid = NULL;
+}
+
+static void stream_component_close(VideoState *is, int stream_index)   // 1201
+{
+  AVFormatContext *ic = is->ic;
+  AVCodecParameters *codecpar = ic->streams[stream_index]->codecpar;
+
+  switch (codecpar->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+      decoder_abort(&is->auddec, &is->sampq);
+      // a prerolled or already handed-over playlist item does not own the device
+      if (!is->audio_dev_shared) {
+        SDL_CloseAudioDevice(audio_dev);
+        audio_dev = 0;
+      }
+      decoder_destroy(&is->auddec);
+      swr_free(&is->swr_ctx);
+      av_freep(&is->audio_buf1);
+      is->audio_buf1_size = 0;
+      is->audio_buf = NULL;
+      break;
+    case AVMEDIA_TYPE_VIDEO:
+      decoder_abort(&is->viddec, &is->pictq);
+      convert_stage_stop(is);
+      framepool_uninstall(is->viddec.avctx);
+      decoder_destroy(&is->viddec);
+      break;
+    case AVMEDIA_TYPE_SUBTITLE:
+      decoder_abort(&is->subdec, &is->subpq);
+      decoder_destroy(&is->subdec);
+      subtitle_release(is);
+      is->subtitle_st = NULL;
+      is->subtitle_stream = -1;
+      break;
+    default:
+      break;
+  }
+}
+
+static void stream_close(VideoState *is)          // 1242
+{
+  SDL_AudioSpec spec;
+
+  for (int i = 0; i < AVMEDIA_TYPE_NB; i++) {
+    framepool_uninstall(is->parked_avctx[i]);
+    avcodec_free_context(&is->parked_avctx[i]);
+  }
+
+  /* no audio stream claimed the speculative device */
+  if (audio_prewarm_take(0, &spec))
+    SDL_CloseAudioDevice(audio_prewarm_dev);
+
+  loop_close(is);
+  frame_queue_destroy(&is->convq);
+  frame_queue_destroy(&is->subpq);
+  subtitle_release(is);
+  for (int i = 0; i < CONVERT_MAX_SLICES; i++) {
+    sws_freeContext(is->img_convert_ctx[i]);
+    sws_freeContext(is->stage_convert_ctx[i]);
+  }
+  sws_freeContext(is->stage_scale_ctx);
+  av_frame_free(&is->stage_tonemapped);
+  viewport_free(&is->viewport);
+  av_frame_free(&is->viewport_src);
+  av_frame_free(&is->stereo_yuv);
+  av_frame_free(&is->stereo_rgb);
+  texpool_release(&texture_pool, is->vid_texture);
+  is->vid_texture = NULL;
+
+  /* persist what read_thread learned about the file for the next open */
+  kfindex_save(&is->kfindex);
+  kfindex_close(&is->kfindex);
+}
+
+/* display the current picture, if any */
+static void video_display(VideoState *is)   // 1342
+{
+  // the window was created hidden while probing, the first picture is where startup joins
+  if (!is->window_shown) {
+    SDL_ShowWindow(window);
+    is->window_shown = 1;
+  }
+
+  // force_refresh while paused or a redisplay of the same pictq entry: keep what is on screen
+  if (is->video_st && video_unchanged(is))
+    return;
+
+  // tiles are composited together by mosaic_display
+  if (mosaic_count) {
+    is->tile_dirty = 1;
+    return;
+  }
+
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+  if (is->audio_st && is->show_mode != SHOW_MODE_VIDEO)
+    // 12-1. video for audio output
+    video_audio_display(is);
+  else if (is->video_st)
+    // 12-2. video-image output
+    video_image_display(is);
+  SDL_RenderPresent(renderer);
+  startup_mark(STARTUP_FIRST_PRESENT);
+  if (is->video_st)
+    video_mark_shown(is);
+}
+
+/* user + system cpu time of the whole process, microseconds */
+static int64_t process_cpu_time(void)
+{
+#ifdef _WIN32
+  FILETIME c, e, k, u;
+  if (!GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u))
+    return 0;
+  return ((((int64_t)k.dwHighDateTime << 32) | k.dwLowDateTime) +
+          (((int64_t)u.dwHighDateTime << 32) | u.dwLowDateTime)) / 10;
+#else
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+/* grid of near-square tiles covering the window */
+static void mosaic_layout(int width, int height)
+{
+  int cols = 1;
+  while (cols * cols < mosaic_count)
+    cols++;
+  int rows = (mosaic_count + cols - 1) / cols;
+
+  for (int i = 0; i < mosaic_count; i++) {
+    VideoState *is = mosaic[i];
+    is->xleft  = (i % cols) * width / cols;
+    is->ytop   = (i / cols) * height / rows;
+    is->width  = ((i % cols) + 1) * width / cols - is->xleft;
+    is->height = ((i / cols) + 1) * height / rows - is->ytop;
+    is->force_refresh = 1;
+  }
+}
+
+/**
+ *  one composite for all tiles: upload every changed picture first, then copy
+ *  all textures and present once, so the renderer sees a single batch per refresh
+ */
+static void mosaic_display(void)
+{
+  int64_t start = av_gettime_relative();
+  int dirty = 0;
+
+  for (int i = 0; i < mosaic_count; i++) {
+    VideoState *is = mosaic[i];
+    if (!is->tile_dirty)
+      continue;
+    dirty = 1;
+    if (is->video_st && is->pictq.rindex_shown && video_image_upload(is) >= 0)
+      subtitle_upload(is);
+  }
+  if (!dirty)
+    return;
+
+  // the back buffer is undefined after a present, so every tile is redrawn
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+  for (int i = 0; i < mosaic_count; i++) {
+    VideoState *is = mosaic[i];
+    if (is->video_st && is->vid_texture && is->pictq.rindex_shown) {
+      video_image_draw(is);
+      if (is->tile_dirty)
+        video_mark_shown(is);
+    }
+    is->tile_dirty = 0;
+  }
+  SDL_RenderPresent(renderer);
+  startup_mark(STARTUP_FIRST_PRESENT);
+
+  int64_t now = av_gettime_relative();
+  mosaic_display_time += now - start;
+  mosaic_presents++;
+
+  // benchmark line: run with 4, 16 or 64 inputs and compare cpu per stream
+  if (!mosaic_stats_start) {
+    mosaic_stats_start = now;
+    mosaic_stats_cpu = process_cpu_time();
+  }
+  else if (now - mosaic_stats_start >= MOSAIC_STATS_PERIOD) {
+    int64_t cpu = process_cpu_time();
+    double elapsed = (now - mosaic_stats_start) / 1000000.0;
+    double load = (cpu - mosaic_stats_cpu) / 1000000.0 / elapsed;
+    av_log(NULL, AV_LOG_INFO, "mosaic: %d tiles, cpu %.1f%% total / %.2f%% per stream, "
+           "display %.2f ms per present, %.1f presents/s\n",
+           mosaic_count, load * 100, load * 100 / mosaic_count,
+           mosaic_display_time / 1000.0 / mosaic_presents, mosaic_presents / elapsed);
+    mosaic_stats_start = now;
+    mosaic_stats_cpu = cpu;
+    mosaic_display_time = 0;
+    mosaic_presents = 0;
+  }
+}
+
+/**
+ *  back from hidden. The decoder's references are the keyframes it was allowed,
+ *  so only video resyncs: videoq takes a flush packet, which starts a new video
+ *  serial and flushes the decoder, and video_thread keeps skipping non-keyframes
+ *  until a keyframe of that serial comes out. Audio plays on untouched
+ */
+static void video_unhide(VideoState *is)
+{
+  is->screen_damaged = 1;
+  is->force_refresh = 1;
+  if (is->video_st) {
+    packet_queue_flush(&is->videoq);
+    packet_queue_put(&is->videoq, &flush_pkt);
+  }
+  // only now, so no keyframe from before the flush ends the skipping
+  SDL_AtomicSet(&is->video_hidden, 0);
+}
+
+/* all clocks advance at the playback speed; audio_thread follows on its next frame */
+static void clocks_apply_speed(VideoState *is)
+{
+  set_clock_speed(&is->audclk, playback_speed);
+  set_clock_speed(&is->vidclk, playback_speed);
+  set_clock_speed(&is->extclk, playback_speed);
+}
+
+/* step through playback_speeds, or back to 1x with step 0 */
+static void playback_speed_step(VideoState *cur_stream, int step)
+{
+  double speed = 1.0;
+  int n = FF_ARRAY_ELEMS(playback_speeds);
+
+  if (step) {
+    int i = 0;
+    while (i < n - 1 && playback_speeds[i] < playback_speed)
+      i++;
+    speed = playback_speeds[av_clip(i + step, 0, n - 1)];
+  }
+  if (speed == playback_speed)
+    return;
+  playback_speed = speed;
+  for (int i = 0; i < FFMAX(mosaic_count, 1); i++) {
+    VideoState *is = mosaic_count ? mosaic[i] : cur_stream;
+    clocks_apply_speed(is);
+    // only audio resyncs: what sampq and the atempo chain hold was stretched for the
+    // old speed, the callback drops it and audio_thread rebuilds the chain
+    SDL_AtomicIncRef(&is->audio_tempo_serial);
+    if (is->next)
+      SDL_AtomicIncRef(&is->next->audio_tempo_serial);
+  }
+  av_log(NULL, AV_LOG_INFO, "playback speed %.2fx\n", speed);
+}
+
+/* 3: packed, left eye, right eye, anaglyph */
+static void stereo_mode_cycle(VideoState *cur_stream)
+{
+  stereo_mode = (stereo_mode + 1) % STEREO_MODE_NB;
+  for (int i = 0; i < FFMAX(mosaic_count, 1); i++) {
+    VideoState *is = mosaic_count ? mosaic[i] : cur_stream;
+    is->screen_damaged = 1;
+    is->force_refresh = 1;
+  }
+  av_log(NULL, AV_LOG_INFO, "stereo 3D: %s\n", stereo_mode_names[stereo_mode]);
+}
+
+/* o: between the 360 view and the flat equirectangular picture */
+static void video_viewport_toggle(VideoState *is)
+{
+  if (!is->viewport_available)
+    return;
+  is->viewport_on = !is->viewport_on;
+  is->screen_damaged = 1;
+  is->force_refresh = 1;
+}
+
+/* dragging across the whole window turns the view by its field of view */
+static void video_viewport_drag(VideoState *is, int xrel, int yrel)
+{
+  if (!is->viewport_on || !is->width)
+    return;
+  is->viewport.yaw -= xrel * is->viewport.fov / is->width;
+  is->viewport.pitch = av_clipd(is->viewport.pitch + yrel * is->viewport.fov / is->width,
+                                -VIEWPORT_PITCH_MAX, VIEWPORT_PITCH_MAX);
+  is->screen_damaged = 1;
+  is->force_refresh = 1;
+}
+
+/**
+ *  drop subtitles past their end, superseded by the next one or queued before
+ *  a seek; the textures of the one shown go back to the pool with it
+ */
+static void subtitle_expire(VideoState *is)
+{
+  Frame *sp, *sp2;
+
+  while (frame_queue_nb_remaining(&is->subpq) > 0) {
+    sp = frame_queue_peek(&is->subpq);
+    sp2 = frame_queue_nb_remaining(&is->subpq) > 1 ? frame_queue_peek_next(&is->subpq) : NULL;
+    if (sp->serial == is->subtitleq.serial &&
+        is->vidclk.pts <= sp->pts + sp->sub.end_display_time / 1000.0 &&
+        !(sp2 && is->vidclk.pts > sp2->pts + sp2->sub.start_display_time / 1000.0))
+      break;
+    if (sp->uploaded) {
+      subtitle_release(is);
+      is->screen_damaged = 1;
+    }
+    frame_queue_next(&is->subpq);
+  }
+}
+
+/* called to display each frame */
+static void video_refresh(void *opaque, double *remaining_time)   // 1556
+{
+  if (is->video_st) {
+    // 10-1. pictures are apart by media time and shown apart by media time / speed
+    last_duration = vp_duration(is, lastvp, vp) / playback_speed;
+    delay = compute_target_delay(last_duration, is);
+
+    // 10-2. subtitles leave at their end time, their textures with them
+    if (is->subtitle_st)
+      subtitle_expire(is);
+    // a subtitle due over the picture already on screen: paused, a still picture, a late packet
+    if (is->subtitle_st && is->pictq.rindex_shown && subtitle_changed(is)) {
+      is->screen_damaged = 1;
+      is->force_refresh = 1;
+    }
+
+    /* 11. display picture */
+    if (!display_disable && !SDL_AtomicGet(&is->video_hidden) && is->force_refresh && is->show_mode == SHOW_MODE_VIDEO && is->pictq.rindex_shown)
+      video_display(is);
+  }
+}
+
+static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)  // 1714
+{
+  // with -convert_stage the picture takes a detour through convert_thread
+  return frame_queue_put_picture(is->convert_tid ? &is->convq : &is->pictq, src_frame, pts, duration, pos, serial);
+}
+
+static int get_video_frame(VideoState *is, AVFrame *frame)    // 1745
+{
+  // 6-1. decode a frame
+  if ((got_picture = decoder_decode_frame(&is->viddec, frame, NULL)) < 0)
+    return -1;
+}
+
+static inline int cmp_audio_fmts(enum AVSampleFormat fmt1, int64_t channel_count1,
+                                 enum AVSampleFormat fmt2, int64_t channel_count2)    // 569
+{
+  /* If channel count == 1, planar and non-planar formats are the same */
+  if (channel_count1 == 1 && channel_count2 == 1)
+    return av_get_packed_sample_fmt(fmt1) != av_get_packed_sample_fmt(fmt2);
+  else
+    return channel_count1 != channel_count2 || fmt1 != fmt2;
+}
+
+static inline int64_t get_valid_channel_layout(int64_t channel_layout, int channels)    // 579
+{
+  if (channel_layout && av_get_channel_layout_nb_channels(channel_layout) == channels)
+    return channel_layout;
+  else
+    return 0;
+}
+
+/* with the other graphs below configure_filtergraph */
+static int configure_audio_filters(VideoState *is, const char *afilters, double speed);
+
+static int audio_thread(void *arg)    // 2003
+{
+  VideoState *is = (VideoState *)arg;
+  AVFrame *frame = av_frame_alloc();
+  Frame *af;
+  int last_serial = -1;
+  int64_t dec_channel_layout;
+  int reconfigure;
+  int got_frame = 0;
+  AVRational tb;
+  int ret = 0;
+
+  int64_t filter_time = 0;
+  int filter_frames = 0;
+  int64_t start;
+
+  // atempo numbers its output samples from zero, they are mapped back to media time here
+  double speed = 1.0;
+  int tempo_serial = -1;
+  double stretch_start = NAN;
+  int64_t stretch_samples = 0;
+
+  if (!frame)
+    return AVERROR(ENOMEM);
+
+  do {
+    // 14-1. decode a frame
+    if ((got_frame = decoder_decode_frame(&is->auddec, frame, NULL)) < 0)
+      goto the_end;
+
+    if (got_frame) {
+      // 14-2. the graph is configured once per input format and reconfigured only when it changes
+      dec_channel_layout = get_valid_channel_layout(frame->channel_layout, frame->channels);
+      reconfigure =
+        cmp_audio_fmts(is->audio_filter_src.fmt, is->audio_filter_src.channels,
+                       (enum AVSampleFormat)frame->format, frame->channels) ||
+        is->audio_filter_src.channel_layout != dec_channel_layout ||
+        is->audio_filter_src.freq           != frame->sample_rate ||
+        is->auddec.pkt_serial               != last_serial ||
+        SDL_AtomicGet(&is->audio_tempo_serial) != tempo_serial;
+
+      if (reconfigure) {
+        char buf1[1024], buf2[1024];
+        av_get_channel_layout_string(buf1, sizeof(buf1), -1, is->audio_filter_src.channel_layout);
+        av_get_channel_layout_string(buf2, sizeof(buf2), -1, dec_channel_layout);
+        av_log(NULL, AV_LOG_DEBUG,
+               "Audio frame changed from rate:%d ch:%d fmt:%s layout:%s serial:%d to rate:%d ch:%d fmt:%s layout:%s serial:%d\n",
+               is->audio_filter_src.freq, is->audio_filter_src.channels, av_get_sample_fmt_name(is->audio_filter_src.fmt), buf1, last_serial,
+               frame->sample_rate, frame->channels, av_get_sample_fmt_name((enum AVSampleFormat)frame->format), buf2, is->auddec.pkt_serial);
+
+        is->audio_filter_src.fmt            = (enum AVSampleFormat)frame->format;
+        is->audio_filter_src.channels       = frame->channels;
+        is->audio_filter_src.channel_layout = dec_channel_layout;
+        is->audio_filter_src.freq           = frame->sample_rate;
+        last_serial                         = is->auddec.pkt_serial;
+
+        tempo_serial = SDL_AtomicGet(&is->audio_tempo_serial);
+        speed = playback_speed;
+        stretch_start = NAN;
+        stretch_samples = 0;
+        if ((ret = configure_audio_filters(is, afilters, speed)) < 0) {
+          av_log(NULL, AV_LOG_ERROR, "Could not configure the audio filter graph \"%s\"\n", afilters ? afilters : "");
+          goto the_end;
+        }
+      }
+
+      if (isnan(stretch_start) && frame->pts != AV_NOPTS_VALUE)
+        stretch_start = frame->pts * av_q2d(av_make_q(1, frame->sample_rate));
+
+      // only the filter calls are timed, not the waits for room in sampq
+      start = av_gettime_relative();
+      if ((ret = av_buffersrc_add_frame(is->in_audio_filter, frame)) < 0)
+        goto the_end;
+      filter_time += av_gettime_relative() - start;
+
+      while (true) {
+        start = av_gettime_relative();
+        ret = av_buffersink_get_frame_flags(is->out_audio_filter, frame, 0);
+        filter_time += av_gettime_relative() - start;
+        if (ret < 0)
+          break;
+
+        tb = av_buffersink_get_time_base(is->out_audio_filter);
+        if (!(af = frame_queue_peek_writable(&is->sampq)))
+          goto the_end;
+
+        af->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+        af->pos = frame->pkt_pos;
+        af->serial = is->auddec.pkt_serial;
+        af->tempo_serial = tempo_serial;
+        // pts and duration in media time; the frame plays for duration / speed
+        af->duration = av_q2d(av_make_q(frame->nb_samples, frame->sample_rate)) * speed;
+        if (speed != 1.0) {
+          af->pts = stretch_start + (double)stretch_samples * speed / frame->sample_rate;
+          stretch_samples += frame->nb_samples;
+        }
+
+        av_frame_move_ref(af->frame, frame);
+        frame_queue_push(&is->sampq);
+
+        if (is->audioq.serial != is->auddec.pkt_serial)
+          break;
+      }
+      if (ret == AVERROR_EOF)
+        is->auddec.finished = is->auddec.pkt_serial;
+
+      if (++filter_frames == AUDIO_FILTER_STATS_FRAMES) {
+        av_log(NULL, AV_LOG_INFO, "audio filter: %.3f ms/frame over %d frames (%s)\n",
+               filter_time / 1000.0 / filter_frames, filter_frames, afilters ? afilters : "aformat only");
+        filter_time = 0;
+        filter_frames = 0;
+      }
+    }
+  } while (ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+
+the_end:
+  avfilter_graph_free(&is->agraph);
+  av_frame_free(&frame);
+  return ret;
+}
+
+static int decoder_start(Decoder *d, int (*fn)(void *), void *arg)  // 2090
+{
+  // 5. create a decoder thread
+  d->decoder_tid = SDL_CreateThread(fn, "decoder", arg);
+}
+
+/**
+ *  decode only keyframes while the window is hidden (frames still flow through
+ *  pictq to keep the clocks honest). After restore, keep skipping until a
+ *  keyframe of the serial video_unhide started comes out, so nothing decodes
+ *  against references that were skipped
+ */
+static void video_update_skip_frame(VideoState *is, AVFrame *decoded)
+{
+  AVCodecContext *avctx = is->viddec.avctx;
+
+  if (SDL_AtomicGet(&is->video_hidden)) {
+    avctx->skip_frame = AVDISCARD_NONKEY;
+  }
+  else if (avctx->skip_frame == AVDISCARD_NONKEY && decoded && decoded->key_frame &&
+           is->viddec.pkt_serial == is->videoq.serial) {
+    avctx->skip_frame = AVDISCARD_DEFAULT;
+  }
+}
+
+static int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
+                                 AVFilterContext *source_ctx, AVFilterContext *sink_ctx)  // 1790
+{
+  int ret;
+  int nb_filters = graph->nb_filters;
+  AVFilterInOut *outputs = NULL, *inputs = NULL;
+
+  if (filtergraph) {
+    outputs = avfilter_inout_alloc();
+    inputs  = avfilter_inout_alloc();
+    if (!outputs || !inputs) {
+      ret = AVERROR(ENOMEM);
+      goto fail;
+    }
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = source_ctx;
+    outputs->pad_idx    = 0;
+    outputs->next       = NULL;
+
+    inputs->name        = av_strdup("out");
+    inputs->filter_ctx  = sink_ctx;
+    inputs->pad_idx     = 0;
+    inputs->next        = NULL;
+
+    if ((ret = avfilter_graph_parse_ptr(graph, filtergraph, &inputs, &outputs, NULL)) < 0)
+      goto fail;
+  }
+  else {
+    if ((ret = avfilter_link(source_ctx, 0, sink_ctx, 0)) < 0)
+      goto fail;
+  }
+
+  /* Reorder the filters to ensure that inputs of the custom filters are merged first */
+  for (int i = 0; i < graph->nb_filters - nb_filters; i++)
+    FFSWAP(AVFilterContext *, graph->filters[i], graph->filters[i + nb_filters]);
+
+  ret = avfilter_graph_config(graph, NULL);
+fail:
+  avfilter_inout_free(&outputs);
+  avfilter_inout_free(&inputs);
+  return ret;
+}
+
+/**
+ *  abuffer -> aformat (planar float) -> atempo chain -> -af graph -> abuffersink.
+ *  Every filter works on fltp, the format libavfilter has SIMD for, whatever the
+ *  decoder produces; the one conversion to the device format, rate and layout is
+ *  swr in audio_decode_frame. atempo stretches by WSOLA, pitch stays where it was
+ */
+static int configure_audio_filters(VideoState *is, const char *afilters, double speed)   // 1936
+{
+  static const enum AVSampleFormat sample_fmts[] = { AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_NONE };
+  AVFilterContext *filt_asrc = NULL, *filt_asink = NULL;
+  char asrc_args[256];
+  char *graph_desc = NULL;
+  int ret;
+
+  avfilter_graph_free(&is->agraph);
+  if (!(is->agraph = avfilter_graph_alloc()))
+    return AVERROR(ENOMEM);
+
+  ret = snprintf(asrc_args, sizeof(asrc_args),
+                 "sample_rate=%d:sample_fmt=%s:channels=%d:time_base=%d/%d",
+                 is->audio_filter_src.freq, av_get_sample_fmt_name(is->audio_filter_src.fmt),
+                 is->audio_filter_src.channels,
+                 1, is->audio_filter_src.freq);
+  if (is->audio_filter_src.channel_layout)
+    snprintf(asrc_args + ret, sizeof(asrc_args) - ret,
+             ":channel_layout=0x%" PRIx64, is->audio_filter_src.channel_layout);
+
+  ret = avfilter_graph_create_filter(&filt_asrc,
+                                     avfilter_get_by_name("abuffer"), "ffplay_abuffer",
+                                     asrc_args, NULL, is->agraph);
+  if (ret < 0)
+    goto end;
+
+  ret = avfilter_graph_create_filter(&filt_asink,
+                                     avfilter_get_by_name("abuffersink"), "ffplay_abuffersink",
+                                     NULL, NULL, is->agraph);
+  if (ret < 0)
+    goto end;
+
+  if ((ret = av_opt_set_int_list(filt_asink, "sample_fmts", sample_fmts, AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0)
+    goto end;
+  if ((ret = av_opt_set_int(filt_asink, "all_channel_counts", 1, AV_OPT_SEARCH_CHILDREN)) < 0)
+    goto end;
+
+  // time stretch first, so the user's filters see fewer samples above 1x
+  graph_desc = av_strdup("aformat=sample_fmts=fltp");
+  for (double tempo = speed; graph_desc && tempo != 1.0; tempo /= FFMIN(tempo, ATEMPO_MAX)) {
+    char *desc = av_asprintf("%s,atempo=%.4f", graph_desc, FFMIN(tempo, ATEMPO_MAX));
+    av_free(graph_desc);
+    graph_desc = desc;
+  }
+  if (graph_desc && afilters) {
+    char *desc = av_asprintf("%s,%s", graph_desc, afilters);
+    av_free(graph_desc);
+    graph_desc = desc;
+  }
+  if (!graph_desc) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = configure_filtergraph(is->agraph, graph_desc, filt_asrc, filt_asink)) < 0)
+    goto end;
+
+  is->in_audio_filter  = filt_asrc;
+  is->out_audio_filter = filt_asink;
+
+end:
+  av_free(graph_desc);
+  if (ret < 0)
+    avfilter_graph_free(&is->agraph);
+  return ret;
+}
+
+/**
+ *  deint: bwdif ahead of the -vf graph, one picture per field. It only touches
+ *  frames flagged interlaced, runs its SIMD kernels slice-threaded across the
+ *  graph's threads and, being in the graph, stays on video_thread
+ */
+#define DEINTERLACE_FILTER "bwdif=mode=send_field:parity=auto:deint=interlaced"
+
+static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const char *vfilters, AVFrame *frame, int deint)  // 1836
+{
+  char sws_flags_str[512] = "";
+  char buffersrc_args[256];
+  int ret;
+  AVFilterContext *filt_src = NULL, *filt_out = NULL;
+  AVCodecParameters *codecpar = is->video_st->codecpar;
+  AVRational fr = av_guess_frame_rate(is->ic, is->video_st, NULL);
+
+  // scale filters the graph inserts use the same flags as our own sws contexts
+  snprintf(sws_flags_str, sizeof(sws_flags_str), "flags=%d", sws_flags);
+  graph->scale_sws_opts = av_strdup(sws_flags_str);
+
+  snprintf(buffersrc_args, sizeof(buffersrc_args),
+           "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+           frame->width, frame->height, frame->format,
+           is->video_st->time_base.num, is->video_st->time_base.den,
+           codecpar->sample_aspect_ratio.num, FFMAX(codecpar->sample_aspect_ratio.den, 1));
+  if (fr.num && fr.den)
+    av_strlcatf(buffersrc_args, sizeof(buffersrc_args), ":frame_rate=%d/%d", fr.num, fr.den);
+
+  if ((ret = avfilter_graph_create_filter(&filt_src, avfilter_get_by_name("buffer"),
+                                          "ffplay_buffer", buffersrc_args, NULL, graph)) < 0)
+    return ret;
+  // no format constraint on the sink: upload_texture takes every layout, natively or converted
+  if ((ret = avfilter_graph_create_filter(&filt_out, avfilter_get_by_name("buffersink"),
+                                          "ffplay_buffersink", NULL, NULL, graph)) < 0)
+    return ret;
+
+  if (deint) {
+    char *graph_desc = vfilters ? av_asprintf(DEINTERLACE_FILTER ",%s", vfilters) : av_strdup(DEINTERLACE_FILTER);
+    if (!graph_desc)
+      return AVERROR(ENOMEM);
+    ret = configure_filtergraph(graph, graph_desc, filt_src, filt_out);
+    av_free(graph_desc);
+  }
+  else {
+    ret = configure_filtergraph(graph, vfilters, filt_src, filt_out);
+  }
+  if (ret < 0)
+    return ret;
+
+  is->in_video_filter  = filt_src;
+  is->out_video_filter = filt_out;
+  return 0;
+}
+
+static int video_thread(void *arg)  // 2101
+{
+  VideoState *is = (VideoState *)arg;
+  AVFrame *frame = av_frame_alloc();
+  double pts;
+  double duration;
+  int ret;
+  AVRational tb = is->video_st->time_base;
+  AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, NULL);
+
+  AVFilterGraph *graph = NULL;
+  AVFilterContext *filt_out = NULL, *filt_in = NULL;
+  int last_w = 0;
+  int last_h = 0;
+  enum AVPixelFormat last_format = AV_PIX_FMT_NONE;
+  int last_serial = -1;
+  int deint = 0;    // set for good once the source turns out interlaced
+
+  if (!frame)
+    return AVERROR(ENOMEM);
+
+  while (true) {
+    // 6. get decoded frame
+    ret = get_video_frame(is, frame);
+    if (ret < 0)
+      goto the_end;
+    if (ret > 0)
+      startup_mark(STARTUP_FIRST_FRAME);
+    video_update_skip_frame(is, ret > 0 ? frame : NULL);
+    if (!ret)
+      continue;
+
+    // 6-2. the graph is built for one input size and format, and rebuilt only when those change
+    // (or after a seek, to drop what its filters buffered). Filters with slice threading run
+    // on one thread per core
+    if (last_w != frame->width || last_h != frame->height || last_format != frame->format ||
+        last_serial != is->viddec.pkt_serial || (deinterlace && frame->interlaced_frame && !deint)) {
+      av_log(NULL, AV_LOG_DEBUG, "Video frame changed from size:%dx%d format:%s serial:%d to size:%dx%d format:%s serial:%d\n",
+             last_w, last_h, (const char *)av_x_if_null(av_get_pix_fmt_name(last_format), "none"), last_serial,
+             frame->width, frame->height,
+             (const char *)av_x_if_null(av_get_pix_fmt_name((enum AVPixelFormat)frame->format), "none"), is->viddec.pkt_serial);
+      avfilter_graph_free(&graph);
+      graph = avfilter_graph_alloc();
+      if (!graph) {
+        ret = AVERROR(ENOMEM);
+        goto the_end;
+      }
+      graph->nb_threads = SDL_GetCPUCount();
+      if (deinterlace && frame->interlaced_frame && !deint) {
+        av_log(NULL, AV_LOG_INFO, "interlaced video, deinterlacing with bwdif\n");
+        deint = 1;
+      }
+      if ((ret = configure_video_filters(graph, is, vfilters, frame, deint)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not configure the video filter graph \"%s\"\n", vfilters ? vfilters : "null");
+        goto the_end;
+      }
+      filt_in  = is->in_video_filter;
+      filt_out = is->out_video_filter;
+      last_w = frame->width;
+      last_h = frame->height;
+      last_format = (enum AVPixelFormat)frame->format;
+      last_serial = is->viddec.pkt_serial;
+      frame_rate = av_buffersink_get_frame_rate(filt_out);
+    }
 
-      }
-      else {
-        // 6-2. decode send-receive pair
-        if (avcodec_send_packet(d->avctx, &pkt) == AVERROR(EAGAIN)) {
+    if ((ret = av_buffersrc_add_frame(filt_in, frame)) < 0)
+      goto the_end;
 
-        }
+    while (ret >= 0) {
+      ret = av_buffersink_get_frame_flags(filt_out, frame, 0);
+      if (ret < 0) {
+        if (ret == AVERROR_EOF)
+          is->viddec.finished = is->viddec.pkt_serial;
+        ret = 0;
+        break;
       }
+
+      tb = av_buffersink_get_time_base(filt_out);
+      duration = (frame_rate.num && frame_rate.den ? av_q2d(av_make_q(frame_rate.den, frame_rate.num)) : 0);
+      pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+      // 7. queue frame
+      ret = queue_picture(is, frame, pts, duration, frame->pkt_pos, is->viddec.pkt_serial);
+      av_frame_unref(frame);
+      if (is->videoq.serial != is->viddec.pkt_serial)
+        break;
     }
+
+    if (ret < 0)
+      goto the_end;
   }
+
+the_end:
+  avfilter_graph_free(&graph);
+  av_frame_free(&frame);
+  return 0;
 }
 
-static void frame_queue_push(FrameQueue *f)       // 772
+/* bitmap subtitles into subpq, in the picture's time; text subtitles are dropped */
+static int subtitle_thread(void *arg)   // 2180
 {
+  VideoState *is = (VideoState *)arg;
+  Frame *sp;
+  int got_subtitle;
 
+  while (true) {
+    if (!(sp = frame_queue_peek_writable(&is->subpq)))
+      return 0;
+    if ((got_subtitle = decoder_decode_frame(&is->subdec, NULL, &sp->sub)) < 0)
+      break;
+    if (got_subtitle && sp->sub.format == 0) {
+      sp->pts = sp->sub.pts != AV_NOPTS_VALUE ? sp->sub.pts / (double)AV_TIME_BASE : 0;
+      sp->serial = is->subdec.pkt_serial;
+      sp->width = is->subdec.avctx->width;
+      sp->height = is->subdec.avctx->height;
+      sp->uploaded = 0;
+      frame_queue_push(&is->subpq);
+    }
+    else if (got_subtitle) {
+      avsubtitle_free(&sp->sub);
+    }
+  }
+  return 0;
 }
 
-static void video_image_display(VideoState *is)   // 957
+/**
+ *  return re-sampled audio data
+ */
+static int audio_decode_frame(VideoState *is)   // 2313
 {
+  Frame *af;
+
+  // 13-1-1-1. skip frames of an old serial, or stretched for a speed no longer in effect
+  do {
+    if (!(af = frame_queue_peek_readable(&is->sampq)))
+      return -1;
+    frame_queue_next(&is->sampq);
+  } while (af->serial != is->audioq.serial || af->tempo_serial != SDL_AtomicGet(&is->audio_tempo_serial));
 
+  /* update the audio clock with the pts; af->duration is media time, also for time-stretched frames */
+  if (!isnan(af->pts))
+    is->audio_clock = af->pts + af->duration;
+  else
+    is->audio_clock = NAN;
+  is->audio_clock_serial = af->serial;
 }
 
-static void video_audio_display(VideoState *is)   // 1043
+/* prepare a new audio buffer */
+static void sdl_audio_callback(void *opaque, Uint8 *stream, int len)    // 2426
 {
+  VideoState *is = audio_owner;
 
+  startup_mark(STARTUP_FIRST_AUDIO_CALLBACK);
+
+  while (len > 0) {
+    if (is->audio_buf_index >= is->audio_buf_size) {
+      // current playlist item drained: continue with the prerolled one inside
+      // this same callback, so there is no silence at the boundary
+      if (is->next && is->next->streams_open &&
+          is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0) {
+        is->audio_dev_shared = 1;
+        is->next->audio_dev_shared = 0;
+        is = is->next;
+        audio_owner = is;
+        continue;
+      }
+      // 13-1-1. re-sampling audio
+      audio_size = audio_decode_frame(is);
+    }
+  }
+  is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
+  /* Let's assume the audio driver that is used by SDL has two periods. */
+  // what is still buffered plays in wall time, the clock counts media time
+  if (!isnan(is->audio_clock)) {
+    set_clock_at(&is->audclk, is->audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec * playback_speed,
+                 is->audio_clock_serial, audio_callback_time / 1000000.0);
+    sync_clock_to_slave(&is->extclk, &is->audclk);
+  }
 }
 
-static void stream_close(VideoState *is)          // 1242
+static int audio_prewarm_thread(void *arg)
 {
+  SDL_AudioSpec wanted_spec;
 
+  memset(&wanted_spec, 0, sizeof(wanted_spec));
+  wanted_spec.freq = AUDIO_PREWARM_FREQ;
+  wanted_spec.format = AUDIO_S16SYS;
+  wanted_spec.channels = AUDIO_PREWARM_CHANNELS;
+  wanted_spec.samples = FFMAX(SDL_AUDIO_MIN_BUFFER_SIZE, 2 << av_log2(wanted_spec.freq / SDL_AUDIO_MAX_CALLBACKS_PER_SEC));
+  wanted_spec.callback = sdl_audio_callback;
+  wanted_spec.userdata = arg;
+  // stays paused until stream_component_open starts playback
+  audio_prewarm_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &audio_prewarm_spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+  return 0;
 }
 
-/* display the current picture, if any */
-static void video_display(VideoState *is)   // 1342
+/* start opening the audio device at the most likely format while the stream is probed */
+static void audio_prewarm_start(VideoState *is)
 {
-  if (is->audio_st && is->show_mode != SHOW_MODE_VIDEO)
-    // 12-1. video for audio output
-    video_audio_display(is);
-  else if (is->video_st)
-    // 12-2. video-image output
-    video_image_display(is);
+  audio_prewarm_tid = SDL_CreateThread(audio_prewarm_thread, "audio_prewarm", is);
 }
 
-/* called to display each frame */
-static void video_refresh(void *opaque, double *remaining_time)   // 1556
+/**
+ *  join the speculative open. return the device if it can play wanted_nb_channels
+ *  (the sample rate is absorbed by swr), otherwise close it and return 0
+ */
+static SDL_AudioDeviceID audio_prewarm_take(int wanted_nb_channels, SDL_AudioSpec *spec)
 {
-  if (is->video_st) {
-    /* 11. display picture */
-    if (!display_disable && is->force_refresh && is->show_mode == SHOW_MODE_VIDEO && is->pictq.rindex_shown)
-      video_display(is);
+  SDL_Thread *tid = (SDL_Thread *)SDL_AtomicSetPtr((void **)&audio_prewarm_tid, NULL);
+  if (!tid)
+    return 0;
+  SDL_WaitThread(tid, NULL);
+  if (!audio_prewarm_dev)
+    return 0;
+  if (wanted_nb_channels > audio_prewarm_spec.channels || audio_prewarm_spec.format != AUDIO_S16SYS) {
+    av_log(NULL, AV_LOG_VERBOSE, "speculative audio device does not fit %d channels, reopening\n", wanted_nb_channels);
+    SDL_CloseAudioDevice(audio_prewarm_dev);
+    audio_prewarm_dev = 0;
+    return 0;
   }
+  *spec = audio_prewarm_spec;
+  return audio_prewarm_dev;
 }
 
-static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)  // 1714
+static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate, struct AudioParams *audio_hw_params) // 2469
 {
-  // 7-1. move decoded frame to frame queue
-  av_frame_move_ref(vp->frame, src_frame);
+  // 13-1. SDL audio callback
+  wanted_spec.callback = sdl_audio_callback;
+
+  // 13-2. open audio device, unless the speculative one already fits
+  audio_dev = audio_prewarm_take(wanted_nb_channels, &spec);
+  if (!audio_dev) {
+    while (!(audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE))) {
+
+    }
+  }
+  startup_mark(STARTUP_AUDIO_OPEN);
+  // a prerolled item opening the device because the one playing has no audio
+  // takes it over in playlist_advance, not while the current item plays
+  if (!((VideoState *)opaque)->audio_dev_shared)
+    audio_owner = (VideoState *)opaque;
 }
 
-static int get_video_frame(VideoState *is, AVFrame *frame)    // 1745
+/* a parked decoder can keep decoding the new source without avcodec_open2 */
+static int codecpar_compatible(const AVCodecContext *avctx, const AVCodecParameters *par)
 {
-  // 6-1. decode a frame
-  if ((got_picture = decoder_decode_frame(&is->viddec, frame, NULL)) < 0)
-    return -1;
+  if (avctx->codec_type != par->codec_type || avctx->codec_id != par->codec_id)
+    return 0;
+  if (avctx->extradata_size != par->extradata_size ||
+      (par->extradata_size && memcmp(avctx->extradata, par->extradata, par->extradata_size)))
+    return 0;
+  switch (par->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+      return avctx->width == par->width && avctx->height == par->height && avctx->pix_fmt == par->format;
+    case AVMEDIA_TYPE_AUDIO:
+      return avctx->sample_rate == par->sample_rate && avctx->channels == par->channels;
+    default:
+      return 0;
+  }
 }
 
-static int audio_thread(void *arg)    // 2003
+static AVCodecContext *decoder_take_parked(VideoState *is, const AVCodecParameters *par)
 {
-  do {
-    // 14-1. decode a frame
-    if ((got_frame = decoder_decode_frame(&is->auddec, frame, NULL)) < 0)
-      goto the_end;
+  AVCodecContext **parked = &is->parked_avctx[par->codec_type];
+  AVCodecContext *avctx = *parked;
 
-    if (got_frame) {
-      // 14-2. queue frame
-      frame_queue_push(&is->sampq);
-    }
-
-  } while (ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+  if (!avctx)
+    return NULL;
+  *parked = NULL;
+  if (!codecpar_compatible(avctx, par)) {
+    framepool_uninstall(avctx);
+    avcodec_free_context(&avctx);
+    return NULL;
+  }
+  // drop references and state of the previous source, keep the opened codec
+  avcodec_flush_buffers(avctx);
+  return avctx;
 }
 
-static int decoder_start(Decoder *d, int (*fn)(void *), void *arg)  // 2090
+/* like stream_component_close, but the decoder context and the audio device stay alive */
+static void stream_component_park(VideoState *is, int stream_index)
 {
-  // 5. create a decoder thread
-  d->decoder_tid = SDL_CreateThread(fn, "decoder", arg);
-}
+  AVCodecParameters *codecpar = is->ic->streams[stream_index]->codecpar;
+  Decoder *d = codecpar->codec_type == AVMEDIA_TYPE_AUDIO ? &is->auddec : &is->viddec;
 
-static int video_thread(void *arg)  // 2101
-{
-  while (true) {
-    // 6. get decoded frame
-    ret = get_video_frame(is, frame);
-    // 7. queue frame
-    ret = queue_picture(is, frame, pts, duration, frame->pkt_pos, is->viddec.pkt_serial);
+  switch (codecpar->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+      decoder_abort(&is->auddec, &is->sampq);
+      swr_free(&is->swr_ctx);
+      av_freep(&is->audio_buf1);
+      is->audio_buf1_size = 0;
+      is->audio_buf = NULL;
+      is->audio_dev_kept = 1;
+      break;
+    case AVMEDIA_TYPE_VIDEO:
+      decoder_abort(&is->viddec, &is->pictq);
+      convert_stage_stop(is);
+      break;
+    default:
+      return;
+  }
+
+  framepool_uninstall(is->parked_avctx[codecpar->codec_type]);
+  avcodec_free_context(&is->parked_avctx[codecpar->codec_type]);
+  is->parked_avctx[codecpar->codec_type] = d->avctx;
+  d->avctx = NULL;
+  decoder_destroy(d);
+
+  is->ic->streams[stream_index]->discard = AVDISCARD_ALL;
+  if (codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+    is->audio_st = NULL;
+    is->audio_stream = -1;
+  }
+  else {
+    is->video_st = NULL;
+    is->video_stream = -1;
   }
 }
 
+/* open a given stream. return 0 if OK */
 /**
- *  return re-sampled audio data
+ *  phone recordings store pictures as the sensor sees them, with a display matrix
+ *  saying how to turn them. ffplay inserts transpose filters that rewrite every
+ *  pixel; here the renderer turns the texture while drawing it, at no cost
  */
-static int audio_decode_frame(VideoState *is)   // 2313
+static void video_rotation_open(VideoState *is, AVStream *st)
 {
+  int32_t matrix[9];
+  uint8_t *side_data = av_stream_get_side_data(st, AV_PKT_DATA_DISPLAYMATRIX, NULL);
 
-}
+  is->rotation = 0;
+  is->rotation_hflip = 0;
+  if (!side_data)
+    return;
 
-/* prepare a new audio buffer */
-static void sdl_audio_callback(void *opaque, Uint8 *stream, int len)    // 2426
-{
-  while (len > 0) {
-    if (is->audio_buf_index >= is->audio_buf_size) {
-      // 13-1-1. re-sampling audio
-      audio_size = audio_decode_frame(is);
-    }
+  memcpy(matrix, side_data, sizeof(matrix));
+  // a negative determinant is a mirror; take it out to get a pure rotation
+  if ((int64_t)matrix[0] * matrix[4] - (int64_t)matrix[1] * matrix[3] < 0) {
+    is->rotation_hflip = 1;
+    av_display_matrix_flip(matrix, 1, 0);
   }
+  double theta = -av_display_rotation_get(matrix);    // counterclockwise -> clockwise
+  if (isnan(theta))
+    theta = 0;
+  is->rotation = ((int)lrint(theta / 90) % 4 + 4) % 4 * 90;
+  if (fabs(theta - lrint(theta / 90) * 90) > 1.0)
+    av_log(NULL, AV_LOG_WARNING, "Odd rotation angle %.2f, shown at %d degrees\n", theta, is->rotation);
+  if (is->rotation || is->rotation_hflip)
+    av_log(NULL, AV_LOG_VERBOSE, "video: rotated %d degrees%s by the renderer\n", is->rotation,
+           is->rotation_hflip ? ", mirrored" : "");
 }
 
-static int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb_channels, int wanted_sample_rate, struct AudioParams *audio_hw_params) // 2469
+static void video_stereo3d_open(VideoState *is, AVStream *st)
 {
-  // 13-1. SDL audio callback
-  wanted_spec.callback = sdl_audio_callback;
+  AVStereo3D *s3d = (AVStereo3D *)av_stream_get_side_data(st, AV_PKT_DATA_STEREO3D, NULL);
 
-  // 13-2. open audio device
-  while (!(audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE))) {
+  memset(&is->stereo3d, 0, sizeof(is->stereo3d));
+  if (!s3d)
+    return;
+  is->stereo3d = *s3d;
+  av_log(NULL, stereo_supported(s3d) ? AV_LOG_VERBOSE : AV_LOG_WARNING, "stereo 3D: %s%s\n",
+         av_stereo3d_type_name(s3d->type), stereo_supported(s3d) ? "" : ", shown as packed");
+}
+
+/* equirectangular 360 video starts as a view facing the front the mapping gives */
+static void video_viewport_open(VideoState *is, AVStream *st)
+{
+  AVSphericalMapping *mapping = (AVSphericalMapping *)av_stream_get_side_data(st, AV_PKT_DATA_SPHERICAL, NULL);
 
+  is->viewport_available = 0;
+  is->viewport_on = 0;
+  if (!mapping)
+    return;
+  if (mapping->projection != AV_SPHERICAL_EQUIRECTANGULAR) {
+    av_log(NULL, AV_LOG_WARNING, "%s projection is shown flat\n", av_spherical_projection_name(mapping->projection));
+    return;
   }
+  viewport_init(&is->viewport, mapping->yaw / 65536.0, mapping->pitch / 65536.0);
+  is->viewport_available = 1;
+  is->viewport_on = spherical;
 }
 
-/* open a given stream. return 0 if OK */
 static int stream_component_open(VideoState *is, int stream_index)  // 2543
 {
   int ret = 0;
 
+  // 3-2. warm decoder left by stream_switch, otherwise open a new one
+  if ((avctx = decoder_take_parked(is, ic->streams[stream_index]->codecpar))) {
+    avctx->pkt_timebase = ic->streams[stream_index]->time_base;
+  }
+  else {
+    // 3-3. video decodes straight into pooled buffers laid out for the texture upload
+    if ((ret = framepool_install(avctx)) < 0)
+      goto fail;
+    if ((ret = avcodec_open2(avctx, codec, &opts)) < 0) {
+      goto fail;
+    }
+  }
+  startup_mark(STARTUP_CODEC_OPEN);
+
   switch (avctx->codec_type) {
     case AVMEDIA_TYPE_AUDIO:
       /* prepare audio output */
-      // 13. audio open
-      if ((ret = audio_open(is, channel_layout, nb_channels, sample_rate, &is->audio_tgt)) < 0)
+      // 13. audio open; after stream_switch the device is still open at audio_tgt
+      // and swr adapts the new source to it
+      if (is->audio_dev_kept) {
+        is->audio_dev_kept = 0;
+        ret = is->audio_hw_buf_size;
+      }
+      else if (is->audio_dev_shared && audio_dev) {
+        // the device may have been opened by an item before the current one, which may have no audio
+        is->audio_tgt = audio_dev_params;
+        ret = audio_dev_buf_size;
+      }
+      else if ((ret = audio_open(is, channel_layout, nb_channels, sample_rate, &is->audio_tgt)) < 0)
         goto fail;
+      else {
+        audio_dev_params = is->audio_tgt;
+        audio_dev_buf_size = ret;
+      }
       // 14. start decoder (thread fn: audio_thread)
       if ((ret = decoder_start(&is->auddec, audio_thread, is)) < 0)
         goto out;
-      SDL_PauseAudioDevice(audio_dev, 0);
+      if (!is->audio_dev_shared)
+        SDL_PauseAudioDevice(audio_dev, 0);
       break;
     case AVMEDIA_TYPE_VIDEO:
-      // 4. start decoder (thread fn: video_thread)
+      if (autorotate)
+        video_rotation_open(is, ic->streams[stream_index]);
+      video_viewport_open(is, ic->streams[stream_index]);
+      video_stereo3d_open(is, ic->streams[stream_index]);
+      // 4. start decoder (thread fn: video_thread), behind the conversion stage if asked for
+      if (convert_stage && (ret = convert_stage_start(is)) < 0)
+        goto out;
       if ((ret = decoder_start(&is->viddec, video_thread, is)) < 0)
         goto out;
       break;
+    case AVMEDIA_TYPE_SUBTITLE:
+      is->subtitle_stream = stream_index;
+      is->subtitle_st = ic->streams[stream_index];
+      decoder_init(&is->subdec, avctx, &is->subtitleq, is->continue_read_thread);
+      // 4-1. start decoder (thread fn: subtitle_thread)
+      if ((ret = decoder_start(&is->subdec, subtitle_thread, is)) < 0)
+        goto out;
+      break;
     default:
       break;
   }
 }
 
+/* continue on the prepared context, timestamps carry on from where the file ended */
+static int loop_splice(VideoState *is)
+{
+  AVFormatContext *ic = is->loop_ic;
+
+  if (ic->nb_streams != is->ic->nb_streams) {
+    av_log(NULL, AV_LOG_WARNING, "%s: streams changed, looping with a seek\n", is->filename);
+    avformat_close_input(&is->loop_ic);
+    is->loop_failed = 1;
+    return AVERROR(EINVAL);
+  }
+  for (unsigned i = 0; i < ic->nb_streams; i++)
+    ic->streams[i]->discard = is->ic->streams[i]->discard;
+
+  is->loop_splice_time = av_gettime_relative();
+  // the other threads may have read a stream pointer of this pass just now, so it
+  // stays open until the next splice; the streams they use from now on are the new ones
+  avformat_close_input(&is->loop_old_ic);
+  is->loop_old_ic = is->ic;
+  is->ic = ic;
+  is->loop_ic = NULL;
+  if (is->audio_st)
+    is->audio_st = ic->streams[is->audio_stream];
+  if (is->video_st)
+    is->video_st = ic->streams[is->video_stream];
+  if (is->subtitle_st)
+    is->subtitle_st = ic->streams[is->subtitle_stream];
+  is->loop_offset = is->loop_end - (ic->start_time != AV_NOPTS_VALUE ? ic->start_time : 0);
+  is->loop_count++;
+  return 0;
+}
+
+static void loop_offset_packet(VideoState *is, AVPacket *pkt)
+{
+  AVStream *st = is->ic->streams[pkt->stream_index];
+
+  if (is->loop_offset) {
+    int64_t offset = av_rescale_q(is->loop_offset, AV_TIME_BASE_Q, st->time_base);
+    if (pkt->pts != AV_NOPTS_VALUE)
+      pkt->pts += offset;
+    if (pkt->dts != AV_NOPTS_VALUE)
+      pkt->dts += offset;
+  }
+  if (pkt->pts != AV_NOPTS_VALUE)
+    is->loop_end = FFMAX(is->loop_end, av_rescale_q(pkt->pts + pkt->duration, st->time_base, AV_TIME_BASE_Q));
+
+  if (is->loop_splice_time) {
+    av_log(NULL, AV_LOG_INFO, "loop %d: transition took %.3f ms\n", is->loop_count,
+           (av_gettime_relative() - is->loop_splice_time) / 1000.0);
+    is->loop_splice_time = 0;
+  }
+}
+
 /* this thread gets the stream from the disk or the network */
 static int read_thread(void *arg)     // 2725
 {
   // 3. open stream
+  if (probecache_load(is->filename, &probe) >= 0) {
+    /* known file: skip format probing, read only as much as the header needs */
+    is->iformat = probecache_input_format(probe);
+    probecache_open_options(probe, &format_opts);
+  }
+  err = avformat_open_input(&ic, is->filename, is->iformat, &format_opts);
+  if (err < 0) {
+    print_error(is->filename, err);
+    ret = -1;
+    goto fail;
+  }
+  startup_mark(STARTUP_OPEN_INPUT);
+  is->ic = ic;
+
+  header_bytes = ic->pb ? avio_tell(ic->pb) : 0;
+  if (probe && probecache_apply(probe, ic) >= 0) {
+    is->probe_cache_hit = 1;
+  }
+  else {
+    err = avformat_find_stream_info(ic, opts);
+    if (err < 0) {
+      av_log(NULL, AV_LOG_WARNING, "%s: could not find codec parameters\n", is->filename);
+      ret = -1;
+      goto fail;
+    }
+    probecache_store(is->filename, ic, header_bytes);
+  }
+  probecache_free(&probe);
+  startup_mark(STARTUP_FIND_STREAM_INFO);
+
+  if (st_index[AVMEDIA_TYPE_AUDIO] >= 0 && !is->audio_disable)
+    stream_component_open(is, st_index[AVMEDIA_TYPE_AUDIO]);
   stream_component_open(is, st_index[AVMEDIA_TYPE_VIDEO]);
+  if (st_index[AVMEDIA_TYPE_SUBTITLE] >= 0 && !subtitle_disable)
+    stream_component_open(is, st_index[AVMEDIA_TYPE_SUBTITLE]);
+  SDL_LockAudioDevice(audio_dev);
+  is->streams_open = 1;
+  SDL_UnlockAudioDevice(audio_dev);
+
+  // 3-1. keyframe index, only usable where the demuxer can resync after a byte seek
+  if (is->video_stream >= 0 && !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK))
+    kfindex_open(&is->kfindex, is->filename, is->video_stream, is->video_st->time_base, kfindex_sidecar);
+
+  for (;;) {
+    if (is->seek_req) {
+      int64_t seek_target = is->seek_pos;
+      int64_t seek_min    = is->seek_rel > 0 ? seek_target - is->seek_rel + 2: INT64_MIN;
+      int64_t seek_max    = is->seek_rel < 0 ? seek_target - is->seek_rel - 2: INT64_MAX;
+      KeyframeIndexEntry kf;
+
+      // relative seeks start from the spliced clock, the file itself starts over every loop
+      if (is->seek_rel && is->loop_offset) {
+        seek_target = FFMAX(seek_target - is->loop_offset, 0);
+        seek_min    = is->seek_rel > 0 ? seek_target - is->seek_rel + 2: INT64_MIN;
+        seek_max    = is->seek_rel < 0 ? seek_target - is->seek_rel - 2: INT64_MAX;
+      }
+      is->loop_offset = 0;
+      is->loop_end = 0;
+
+      ret = -1;
+      if (!(is->seek_flags & AVSEEK_FLAG_BYTE) &&
+          kfindex_lookup(&is->kfindex, av_rescale_q(seek_target, AV_TIME_BASE_Q, is->video_st->time_base), &kf) >= 0) {
+        int64_t kf_time = av_rescale_q(kf.pts, is->video_st->time_base, AV_TIME_BASE_Q);
+        /* known keyframe: one byte seek instead of a bisection through the file */
+        if (kf_time >= seek_min && kf_time <= seek_max)
+          ret = avformat_seek_file(is->ic, -1, kf.pos, kf.pos, kf.pos, AVSEEK_FLAG_BYTE);
+      }
+      if (ret < 0)
+        ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
+      // whatever comes next is not the keyframe after the last one indexed
+      kfindex_break(&is->kfindex);
+      if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: error while seeking\n", is->ic->url);
+      }
+      else {
+        // flush packet queues, reset external clock (ffplay 2853-2870)
+      }
+      is->seek_req = 0;
+    }
+
+    // 3-3. seamless loop: get the next pass ready before this one runs out
+    if (seamless_loop && !is->loop_tid && !is->loop_ic && !is->loop_failed && ic->pb &&
+        avio_size(ic->pb) - avio_tell(ic->pb) < LOOP_PREPARE_BYTES)
+      loop_prepare(is);
 
+    ret = av_read_frame(ic, pkt);
+    if (ret < 0) {
+      if (ret == AVERROR_EOF && loop_prepared(is) && loop_splice(is) >= 0) {
+        // no null packets, no flush: the decoders just keep going
+        ic = is->ic;
+        continue;
+      }
+      // eof / error handling (ffplay 2935-2960)
+    }
+    startup_mark(STARTUP_FIRST_PACKET);
+
+    if (pkt->stream_index == is->video_stream && (pkt->flags & AV_PKT_FLAG_KEY))
+      kfindex_add(&is->kfindex, pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts, pkt->pos);
+    if (seamless_loop)
+      loop_offset_packet(is, pkt);
+  }
 }
 
 static VideoState *stream_open(const char *filename, AVInputFormat *iformat)  // 3047
@@ -209,10 +2599,27 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat)  //
   is->filename = av_strdup(filename);
   if (!is->filename)
     goto fail;
+  is->shown_rindex = -1;
+
+  if (frame_queue_init(&is->convq, &is->videoq, CONVERT_QUEUE_SIZE, 0) < 0)
+    goto fail;
+  if (frame_queue_init(&is->subpq, &is->subtitleq, SUBPICTURE_QUEUE_SIZE, 0) < 0)
+    goto fail;
 
   // TODO
 
-  // 2. create a thread
+  clocks_apply_speed(is);
+
+  // 2. create a thread, with the audio device already opening in parallel so
+  // audio_open never races ahead of it. A playlist item prerolled while
+  // another one plays borrows the running device instead
+  // Mosaic tiles after the first one stay silent
+  if (mosaic_count)
+    is->audio_disable = 1;
+  else if (playlist_pos > 0)
+    is->audio_dev_shared = 1;
+  else
+    audio_prewarm_start(is);
   is->read_tid = SDL_CreateThread(read_thread, "read_thread", is);
   if (!is->read_tid) {
     av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
@@ -223,16 +2630,165 @@ fail:
   return is;
 }
 
+/**
+ *  switch to another source without tearing down the output side: the audio
+ *  device, the textures and, when codec parameters match, the opened decoders
+ *  are kept and only flushed. return 0 if OK
+ */
+static int stream_switch(VideoState *is, const char *filename)
+{
+  char *new_filename = av_strdup(filename);
+  if (!new_filename)
+    return AVERROR(ENOMEM);
+
+  // stop the old source; read_thread first so nothing refills the queues
+  SDL_PauseAudioDevice(audio_dev, 1);
+  is->abort_request = 1;
+  SDL_WaitThread(is->read_tid, NULL);
+  is->read_tid = NULL;
+
+  for (int i = 0; i < AVMEDIA_TYPE_NB; i++) {
+    framepool_uninstall(is->parked_avctx[i]);
+    avcodec_free_context(&is->parked_avctx[i]);
+  }
+  if (is->audio_stream >= 0)
+    stream_component_park(is, is->audio_stream);
+  if (is->video_stream >= 0)
+    stream_component_park(is, is->video_stream);
+  if (is->subtitle_stream >= 0)
+    stream_component_close(is, is->subtitle_stream);
+  loop_close(is);
+  avformat_close_input(&is->ic);
+
+  kfindex_save(&is->kfindex);
+  kfindex_close(&is->kfindex);
+
+  packet_queue_flush(&is->videoq);
+  packet_queue_flush(&is->audioq);
+  packet_queue_flush(&is->subtitleq);
+
+  av_free(is->filename);
+  is->filename = new_filename;
+  is->abort_request = 0;
+  is->eof = 0;
+  is->probe_cache_hit = 0;
+  is->loop_offset = 0;
+  is->loop_end = 0;
+  is->loop_count = 0;
+  is->loop_failed = 0;
+  is->audio_clock_serial = -1;
+  init_clock(&is->vidclk, &is->videoq.serial);
+  init_clock(&is->audclk, &is->audioq.serial);
+  init_clock(&is->extclk, &is->extclk.serial);
+  clocks_apply_speed(is);
+
+  is->read_tid = SDL_CreateThread(read_thread, "read_thread", is);
+  if (!is->read_tid) {
+    av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+/* the current item is done on both outputs and the next one can take the screen */
+static int playlist_handover_due(VideoState *is)
+{
+  if (!is->next || is->handover_pending)
+    return 0;
+  if (is->audio_st && audio_owner != is->next)
+    return 0;
+  if (is->video_st && (is->viddec.finished != is->videoq.serial || frame_queue_nb_remaining(&is->pictq) > 0))
+    return 0;
+  return 1;
+}
+
+/* open the next playlist item in the background once the current one is on screen */
+static void playlist_preroll(VideoState *is)
+{
+  if (mosaic_count || is->next || !is->window_shown || playlist_pos + 1 >= playlist_len)
+    return;
+  VideoState *next = stream_open(playlist[++playlist_pos], file_iformat);
+  if (!next) {
+    av_log(NULL, AV_LOG_ERROR, "could not preroll %s\n", playlist[playlist_pos]);
+    return;
+  }
+  SDL_LockAudioDevice(audio_dev);
+  is->next = next;
+  SDL_UnlockAudioDevice(audio_dev);
+}
+
+static VideoState *playlist_advance(VideoState *is)
+{
+  VideoState *next = is->next;
+
+  SDL_LockAudioDevice(audio_dev);
+  // no audio in the current item: the next one starts driving the device now
+  if (!is->audio_st) {
+    next->audio_dev_shared = 0;
+    audio_owner = next;
+  }
+  is->next = NULL;
+  is->audio_dev_shared = 1;
+  SDL_UnlockAudioDevice(audio_dev);
+  if (!is->audio_st && next->audio_st)
+    SDL_PauseAudioDevice(audio_dev, 0);
+
+  // hand over the texture too, so the last picture stays up until the next one is
+  // uploaded; uploads take their own back texture from the pool at any size
+  if (!next->vid_texture) {
+    next->vid_texture = is->vid_texture;
+    is->vid_texture = NULL;
+  }
+  next->window_shown = is->window_shown;
+
+  stream_close(is);
+  return next;
+}
+
 static void refresh_loop_wait_event(VideoState *is, SDL_Event *event)   // 3199
 {
   while (!SDL_PeepEvents(event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT)) {
-    if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
+    startup_report(is);
+    playlist_preroll(is);
+    if (playlist_handover_due(is)) {
+      SDL_Event next_event;
+      next_event.type = FF_NEXT_EVENT;
+      is->handover_pending = 1;
+      SDL_PushEvent(&next_event);
+    }
+    if (mosaic_count) {
+      // 10. video refresh, every tile against one wait and one present
+      for (int i = 0; i < mosaic_count; i++)
+        if (!mosaic[i]->paused || mosaic[i]->force_refresh)
+          video_refresh(mosaic[i], &remaining_time);
+      mosaic_display();
+    }
+    else if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
       // 10. video refresh
       video_refresh(is, &remaining_time);
   }
 }
 
 /* handle an event sent by the GUI */
+static void do_exit(VideoState *is)   // 1301
+{
+  for (int i = 0; i < FFMAX(mosaic_count, 1); i++) {
+    VideoState *tile = mosaic_count ? mosaic[i] : is;
+    if (tile)
+      stream_close(tile);
+  }
+  slicepool_destroy(&convert_pool);
+  // pooled textures belong to the renderer and have to go first
+  texpool_uninit(&texture_pool);
+  if (renderer)
+    SDL_DestroyRenderer(renderer);
+  if (window)
+    SDL_DestroyWindow(window);
+  SDL_Quit();
+  av_log(NULL, AV_LOG_QUIET, "%s", "");
+  exit(0);
+}
+
 static void event_loop(VideoState *cur_stream)  // 3244
 {
   SDL_Event event;
@@ -240,17 +2796,212 @@ static void event_loop(VideoState *cur_stream)  // 3244
   while (true) {
     // 9. video refresh
     refresh_loop_wait_event(cur_stream, &event);
+    switch (event.type) {
+      case SDL_WINDOWEVENT:
+        if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED && mosaic_count)
+          mosaic_layout(event.window.data1, event.window.data2);
+        // window contents are gone: the next refresh has to present even an unchanged picture
+        if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          for (int i = 0; i < FFMAX(mosaic_count, 1); i++) {
+            VideoState *is = mosaic_count ? mosaic[i] : cur_stream;
+            is->screen_damaged = 1;
+            is->force_refresh = 1;
+          }
+        }
+        // background players only keep audio going; SDL 2.0.8 reports no occlusion,
+        // so minimized and hidden are what we can act on
+        if (event.window.event == SDL_WINDOWEVENT_MINIMIZED || event.window.event == SDL_WINDOWEVENT_HIDDEN ||
+            event.window.event == SDL_WINDOWEVENT_RESTORED || event.window.event == SDL_WINDOWEVENT_SHOWN) {
+          int hidden = event.window.event == SDL_WINDOWEVENT_MINIMIZED || event.window.event == SDL_WINDOWEVENT_HIDDEN;
+          for (int i = 0; i < FFMAX(mosaic_count, 1); i++) {
+            VideoState *is = mosaic_count ? mosaic[i] : cur_stream;
+            if (hidden)
+              SDL_AtomicSet(&is->video_hidden, 1);
+            else if (SDL_AtomicGet(&is->video_hidden))
+              video_unhide(is);
+          }
+        }
+        break;
+      case SDL_KEYDOWN:
+        switch (event.key.keysym.sym) {
+          case SDLK_ESCAPE:
+          case SDLK_q:
+            do_exit(cur_stream);
+            break;
+          case SDLK_LEFTBRACKET:
+            playback_speed_step(cur_stream, -1);
+            break;
+          case SDLK_RIGHTBRACKET:
+            playback_speed_step(cur_stream, 1);
+            break;
+          case SDLK_BACKSPACE:
+            playback_speed_step(cur_stream, 0);
+            break;
+          case SDLK_o:
+            video_viewport_toggle(cur_stream);
+            break;
+          case SDLK_3:
+            stereo_mode_cycle(cur_stream);
+            break;
+          default:
+            break;
+        }
+        break;
+      case SDL_MOUSEMOTION:
+        if (event.motion.state & SDL_BUTTON_LMASK)
+          video_viewport_drag(cur_stream, event.motion.xrel, event.motion.yrel);
+        break;
+      case SDL_QUIT:
+        do_exit(cur_stream);
+        break;
+      case FF_NEXT_EVENT:
+        cur_stream = playlist_advance(cur_stream);
+        clocks_apply_speed(cur_stream);
+        break;
+      case SDL_DROPFILE:
+        // zap to the dropped source, keeping the output side warm
+        if (stream_switch(cur_stream, event.drop.file) < 0)
+          av_log(NULL, AV_LOG_ERROR, "could not switch to %s\n", event.drop.file);
+        SDL_free(event.drop.file);
+        break;
+      default:
+        break;
+    }
   }
 }
 
 int main(int argc, char *argv[])  // 3645
 {
   VideoState *is;
+  int flags;
+
+  startup_origin = av_gettime_relative();
 
   input_filename = "little.mkv";
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-loop")) {
+      seamless_loop = 1;
+    }
+    else if (!strcmp(argv[1], "-kfindex_sidecar")) {
+      kfindex_sidecar = 1;
+    }
+    else if (!strcmp(argv[1], "-mosaic")) {
+      mosaic_count = -1;    // set once the tiles are open
+    }
+    else if (!strcmp(argv[1], "-vf") && argc > 2) {
+      vfilters = argv[2];
+      argv++;
+      argc--;
+    }
+    else if (!strcmp(argv[1], "-af") && argc > 2) {
+      afilters = argv[2];
+      argv++;
+      argc--;
+    }
+    else if (!strcmp(argv[1], "-speed") && argc > 2) {
+      playback_speed = av_clipd(atof(argv[2]), PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX);
+      argv++;
+      argc--;
+    }
+    else if (!strcmp(argv[1], "-nodeint")) {
+      deinterlace = 0;
+    }
+    else if (!strcmp(argv[1], "-noautorotate")) {
+      autorotate = 0;
+    }
+    else if (!strcmp(argv[1], "-sn")) {
+      subtitle_disable = 1;
+    }
+    else if (!strcmp(argv[1], "-no360")) {
+      spherical = 0;
+    }
+    else if (!strcmp(argv[1], "-stereo") && argc > 2) {
+      stereo_mode = -1;
+      for (int i = 0; i < STEREO_MODE_NB; i++)
+        if (!strcmp(argv[2], stereo_mode_names[i]))
+          stereo_mode = i;
+      if (stereo_mode < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Unknown stereo mode %s, use both, left, right or anaglyph\n", argv[2]);
+        exit(1);
+      }
+      argv++;
+      argc--;
+    }
+    else if (!strcmp(argv[1], "-convert_stage")) {
+      convert_stage = 1;
+    }
+    else if (!strcmp(argv[1], "-convert_threads") && argc > 2) {
+      convert_threads = atoi(argv[2]);
+      argv++;
+      argc--;
+    }
+    else {
+      break;
+    }
+    argv++;
+    argc--;
+  }
+  if (argc > 1) {
+    // every argument is a playlist item, played back to back without gaps
+    playlist = (const char **)&argv[1];
+    playlist_len = argc - 1;
+    input_filename = playlist[0];
+  }
+
+  flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
+  if (SDL_Init(flags)) {
+    av_log(NULL, AV_LOG_FATAL, "Could not initialize SDL - %s\n", SDL_GetError());
+    exit(1);
+  }
+  startup_mark(STARTUP_SDL_INIT);
+
+  // everything the decoder and convert threads read exists before the first of them starts
+  renderer_mutex = SDL_CreateMutex();
+  renderer_cond = SDL_CreateCond();
+  if (!renderer_mutex || !renderer_cond) {
+    av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+    exit(1);
+  }
+  if (convert_threads < 0)
+    convert_threads = SDL_GetCPUCount();
+  convert_pool = slicepool_create(av_clip(convert_threads, 1, CONVERT_MAX_SLICES) - 1);
+
+  // 1. open stream: probing starts on read_thread right away
+  if (mosaic_count) {
+    mosaic_count = 0;
+    for (int i = 0; i < FFMIN(playlist_len, MOSAIC_MAX); i++) {
+      if (!(mosaic[mosaic_count] = stream_open(playlist[i], file_iformat)))
+        av_log(NULL, AV_LOG_ERROR, "could not open tile %s\n", playlist[i]);
+      else
+        mosaic_count++;
+    }
+    is = mosaic_count ? mosaic[0] : NULL;
+  }
+  else {
+    is = stream_open(input_filename, file_iformat);
+  }
+  if (!is) {
+    av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
+    exit(1);
+  }
 
-  // 1. open stream
-  is = stream_open(input_filename, file_iformat);
+  // 1-1. meanwhile the window and renderer are created here (SDL wants them on
+  // the main thread) while the audio device opens on its own thread; all three
+  // join at the first frame
+  window = SDL_CreateWindow(program_name, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, default_width, default_height, SDL_WINDOW_HIDDEN | SDL_WINDOW_RESIZABLE);
+  startup_mark(STARTUP_WINDOW);
+  if (window) {
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    startup_mark(STARTUP_RENDERER);
+  }
+  if (!window || !renderer) {
+    av_log(NULL, AV_LOG_FATAL, "Failed to create window or renderer: %s\n", SDL_GetError());
+    exit(1);
+  }
+  renderer_probe_formats();
+  texpool_init(&texture_pool, renderer, TEXTURE_POOL_BUDGET);
+  if (mosaic_count)
+    mosaic_layout(default_width, default_height);
 
   // 8. event loop
   event_loop(is);
@@ -0,0 +1,297 @@
+extern "C" {
+  #include <libavutil/avstring.h>
+  #include <libavutil/intreadwrite.h>
+}
+
+#include <string.h>
+
+#include "cacheutil.h"
+#include "probecache.h"
+
+#define DEFAULT_PROBESIZE   5000000   // libavformat's own default
+
+static int64_t read_cursor_rl64(const uint8_t **p, const uint8_t *end, int *err)
+{
+  if (end - *p < 8) {
+    *err = 1;
+    return 0;
+  }
+  int64_t v = AV_RL64(*p);
+  *p += 8;
+  return v;
+}
+
+static int32_t read_cursor_rl32(const uint8_t **p, const uint8_t *end, int *err)
+{
+  if (end - *p < 4) {
+    *err = 1;
+    return 0;
+  }
+  int32_t v = AV_RL32(*p);
+  *p += 4;
+  return v;
+}
+
+static AVRational read_cursor_q(const uint8_t **p, const uint8_t *end, int *err)
+{
+  AVRational q;
+  q.num = read_cursor_rl32(p, end, err);
+  q.den = read_cursor_rl32(p, end, err);
+  return q;
+}
+
+static int probecache_parse(ProbeCache *pc, const CacheFileId *id, const uint8_t *p, const uint8_t *end)
+{
+  int err = 0;
+
+  if (read_cursor_rl32(&p, end, &err) != (int32_t)PROBECACHE_MAGIC ||
+      read_cursor_rl32(&p, end, &err) != PROBECACHE_VERSION ||
+      read_cursor_rl64(&p, end, &err) != id->size ||
+      read_cursor_rl64(&p, end, &err) != id->mtime || err)
+    return AVERROR_INVALIDDATA;
+
+  if (end - p < (ptrdiff_t)sizeof(pc->format_name))
+    return AVERROR_INVALIDDATA;
+  memcpy(pc->format_name, p, sizeof(pc->format_name));
+  pc->format_name[sizeof(pc->format_name) - 1] = 0;
+  p += sizeof(pc->format_name);
+
+  pc->header_bytes = read_cursor_rl64(&p, end, &err);
+  pc->start_time   = read_cursor_rl64(&p, end, &err);
+  pc->duration     = read_cursor_rl64(&p, end, &err);
+  pc->bit_rate     = read_cursor_rl64(&p, end, &err);
+  pc->nb_streams   = read_cursor_rl32(&p, end, &err);
+  if (err || pc->nb_streams <= 0 || pc->nb_streams > 1024)
+    return AVERROR_INVALIDDATA;
+
+  pc->streams = (ProbeCacheStream *)av_mallocz_array(pc->nb_streams, sizeof(*pc->streams));
+  if (!pc->streams)
+    return AVERROR(ENOMEM);
+
+  for (int i = 0; i < pc->nb_streams; i++) {
+    ProbeCacheStream *s = &pc->streams[i];
+    AVCodecParameters *par = s->par = avcodec_parameters_alloc();
+    if (!par)
+      return AVERROR(ENOMEM);
+
+    s->time_base      = read_cursor_q(&p, end, &err);
+    s->avg_frame_rate = read_cursor_q(&p, end, &err);
+    s->r_frame_rate   = read_cursor_q(&p, end, &err);
+    s->start_time     = read_cursor_rl64(&p, end, &err);
+    s->duration       = read_cursor_rl64(&p, end, &err);
+
+    par->codec_type            = (enum AVMediaType)read_cursor_rl32(&p, end, &err);
+    par->codec_id              = (enum AVCodecID)read_cursor_rl32(&p, end, &err);
+    par->codec_tag             = read_cursor_rl32(&p, end, &err);
+    par->format                = read_cursor_rl32(&p, end, &err);
+    par->bit_rate              = read_cursor_rl64(&p, end, &err);
+    par->bits_per_coded_sample = read_cursor_rl32(&p, end, &err);
+    par->bits_per_raw_sample   = read_cursor_rl32(&p, end, &err);
+    par->profile               = read_cursor_rl32(&p, end, &err);
+    par->level                 = read_cursor_rl32(&p, end, &err);
+    par->width                 = read_cursor_rl32(&p, end, &err);
+    par->height                = read_cursor_rl32(&p, end, &err);
+    par->sample_aspect_ratio   = read_cursor_q(&p, end, &err);
+    par->field_order           = (enum AVFieldOrder)read_cursor_rl32(&p, end, &err);
+    par->color_range           = (enum AVColorRange)read_cursor_rl32(&p, end, &err);
+    par->color_primaries       = (enum AVColorPrimaries)read_cursor_rl32(&p, end, &err);
+    par->color_trc             = (enum AVColorTransferCharacteristic)read_cursor_rl32(&p, end, &err);
+    par->color_space           = (enum AVColorSpace)read_cursor_rl32(&p, end, &err);
+    par->chroma_location       = (enum AVChromaLocation)read_cursor_rl32(&p, end, &err);
+    par->video_delay           = read_cursor_rl32(&p, end, &err);
+    par->channel_layout        = read_cursor_rl64(&p, end, &err);
+    par->channels              = read_cursor_rl32(&p, end, &err);
+    par->sample_rate           = read_cursor_rl32(&p, end, &err);
+    par->block_align           = read_cursor_rl32(&p, end, &err);
+    par->frame_size            = read_cursor_rl32(&p, end, &err);
+    par->initial_padding       = read_cursor_rl32(&p, end, &err);
+    par->trailing_padding      = read_cursor_rl32(&p, end, &err);
+    par->seek_preroll          = read_cursor_rl32(&p, end, &err);
+
+    int extradata_size = read_cursor_rl32(&p, end, &err);
+    if (err || extradata_size < 0 || end - p < extradata_size)
+      return AVERROR_INVALIDDATA;
+    if (extradata_size) {
+      par->extradata = (uint8_t *)av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if (!par->extradata)
+        return AVERROR(ENOMEM);
+      memcpy(par->extradata, p, extradata_size);
+      par->extradata_size = extradata_size;
+      p += extradata_size;
+    }
+  }
+  return 0;
+}
+
+int probecache_load(const char *filename, ProbeCache **ppc)
+{
+  CacheFileId id;
+  CacheMapping map;
+  char path[1024];
+  int ret;
+
+  *ppc = NULL;
+  if ((ret = cache_file_id(filename, &id)) < 0 ||
+      (ret = cache_file_path(path, sizeof(path), filename, PROBECACHE_EXT, 0)) < 0 ||
+      (ret = cache_map_file(path, &map)) < 0)
+    return ret;
+
+  ProbeCache *pc = (ProbeCache *)av_mallocz(sizeof(*pc));
+  if (!pc) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = probecache_parse(pc, &id, map.data, map.data + map.size)) < 0 ||
+      !probecache_input_format(pc)) {
+    av_log(NULL, AV_LOG_VERBOSE, "ignoring stale probe cache %s\n", path);
+    probecache_free(&pc);
+    ret = AVERROR_INVALIDDATA;
+    goto end;
+  }
+  *ppc = pc;
+end:
+  cache_unmap_file(&map);
+  return ret;
+}
+
+AVInputFormat *probecache_input_format(ProbeCache *pc)
+{
+  // format_name of a demuxer may be a list ("mov,mp4,m4a,3gp,3g2,mj2"), the first one is its short name
+  char name[64];
+  av_strlcpy(name, pc->format_name, sizeof(name));
+  name[strcspn(name, ",")] = 0;
+  return av_find_input_format(name);
+}
+
+void probecache_open_options(ProbeCache *pc, AVDictionary **format_opts)
+{
+  // enough for the demuxer to read its header (PAT/PMT, moov, EBML) again, no more
+  av_dict_set_int(format_opts, "probesize", FFMAX(2 * pc->header_bytes, 32768), 0);
+  av_dict_set_int(format_opts, "analyzeduration", 0, 0);
+}
+
+int probecache_apply(ProbeCache *pc, AVFormatContext *ic)
+{
+  if (ic->nb_streams != (unsigned)pc->nb_streams)
+    goto miss;
+  for (int i = 0; i < pc->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    ProbeCacheStream *s = &pc->streams[i];
+    if (st->codecpar->codec_type != s->par->codec_type ||
+        (st->codecpar->codec_id != AV_CODEC_ID_NONE && st->codecpar->codec_id != s->par->codec_id) ||
+        av_cmp_q(st->time_base, s->time_base))
+      goto miss;
+  }
+
+  for (int i = 0; i < pc->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    ProbeCacheStream *s = &pc->streams[i];
+    int ret;
+    if ((ret = avcodec_parameters_copy(st->codecpar, s->par)) < 0)
+      return ret;
+    st->avg_frame_rate = s->avg_frame_rate;
+    st->r_frame_rate = s->r_frame_rate;
+    st->start_time = s->start_time;
+    st->duration = s->duration;
+  }
+  ic->start_time = pc->start_time;
+  ic->duration = pc->duration;
+  ic->bit_rate = pc->bit_rate;
+  return 0;
+
+miss:
+  // layout changed under the same size/mtime (or a lazily created stream): probe for real
+  ic->probesize = DEFAULT_PROBESIZE;
+  ic->max_analyze_duration = 0;
+  return AVERROR(EAGAIN);
+}
+
+int probecache_store(const char *filename, AVFormatContext *ic, int64_t header_bytes)
+{
+  CacheFileId id;
+  AVIOContext *pb;
+  uint8_t *buf;
+  char path[1024];
+  char format_name[64] = { 0 };
+  int ret, size;
+
+  if (!ic->nb_streams ||
+      (ret = cache_file_id(filename, &id)) < 0 ||
+      (ret = cache_file_path(path, sizeof(path), filename, PROBECACHE_EXT, 0)) < 0 ||
+      (ret = avio_open_dyn_buf(&pb)) < 0)
+    return ret;
+
+  avio_wl32(pb, PROBECACHE_MAGIC);
+  avio_wl32(pb, PROBECACHE_VERSION);
+  avio_wl64(pb, id.size);
+  avio_wl64(pb, id.mtime);
+  av_strlcpy(format_name, ic->iformat->name, sizeof(format_name));
+  avio_write(pb, (const unsigned char *)format_name, sizeof(format_name));
+  avio_wl64(pb, header_bytes);
+  avio_wl64(pb, ic->start_time);
+  avio_wl64(pb, ic->duration);
+  avio_wl64(pb, ic->bit_rate);
+  avio_wl32(pb, ic->nb_streams);
+
+  for (unsigned i = 0; i < ic->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    AVCodecParameters *par = st->codecpar;
+
+    avio_wl32(pb, st->time_base.num);
+    avio_wl32(pb, st->time_base.den);
+    avio_wl32(pb, st->avg_frame_rate.num);
+    avio_wl32(pb, st->avg_frame_rate.den);
+    avio_wl32(pb, st->r_frame_rate.num);
+    avio_wl32(pb, st->r_frame_rate.den);
+    avio_wl64(pb, st->start_time);
+    avio_wl64(pb, st->duration);
+
+    avio_wl32(pb, par->codec_type);
+    avio_wl32(pb, par->codec_id);
+    avio_wl32(pb, par->codec_tag);
+    avio_wl32(pb, par->format);
+    avio_wl64(pb, par->bit_rate);
+    avio_wl32(pb, par->bits_per_coded_sample);
+    avio_wl32(pb, par->bits_per_raw_sample);
+    avio_wl32(pb, par->profile);
+    avio_wl32(pb, par->level);
+    avio_wl32(pb, par->width);
+    avio_wl32(pb, par->height);
+    avio_wl32(pb, par->sample_aspect_ratio.num);
+    avio_wl32(pb, par->sample_aspect_ratio.den);
+    avio_wl32(pb, par->field_order);
+    avio_wl32(pb, par->color_range);
+    avio_wl32(pb, par->color_primaries);
+    avio_wl32(pb, par->color_trc);
+    avio_wl32(pb, par->color_space);
+    avio_wl32(pb, par->chroma_location);
+    avio_wl32(pb, par->video_delay);
+    avio_wl64(pb, par->channel_layout);
+    avio_wl32(pb, par->channels);
+    avio_wl32(pb, par->sample_rate);
+    avio_wl32(pb, par->block_align);
+    avio_wl32(pb, par->frame_size);
+    avio_wl32(pb, par->initial_padding);
+    avio_wl32(pb, par->trailing_padding);
+    avio_wl32(pb, par->seek_preroll);
+    avio_wl32(pb, par->extradata_size);
+    if (par->extradata_size)
+      avio_write(pb, par->extradata, par->extradata_size);
+  }
+
+  size = avio_close_dyn_buf(pb, &buf);
+  ret = cache_write_file(path, buf, size, NULL, 0);
+  av_free(buf);
+  return ret;
+}
+
+void probecache_free(ProbeCache **ppc)
+{
+  ProbeCache *pc = *ppc;
+  if (!pc)
+    return;
+  for (int i = 0; pc->streams && i < pc->nb_streams; i++)
+    avcodec_parameters_free(&pc->streams[i].par);
+  av_freep(&pc->streams);
+  av_freep(ppc);
+}
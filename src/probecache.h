@@ -0,0 +1,54 @@
+#ifndef KSPLAYER_PROBECACHE_H
+#define KSPLAYER_PROBECACHE_H
+
+extern "C" {
+  #include <libavformat/avformat.h>
+}
+
+/**
+ *  cached outcome of avformat_open_input + avformat_find_stream_info,
+ *  keyed by path + size + mtime. On a hit the file is opened with the cached
+ *  input format and a minimal probesize, the cached codec parameters are
+ *  injected into the streams and avformat_find_stream_info is skipped.
+ */
+#define PROBECACHE_EXT      ".ksprobe"
+#define PROBECACHE_MAGIC    MKTAG('K', 'S', 'P', 'C')
+#define PROBECACHE_VERSION  1
+
+typedef struct ProbeCacheStream {
+  AVCodecParameters *par;
+  AVRational time_base;
+  AVRational avg_frame_rate;
+  AVRational r_frame_rate;
+  int64_t start_time;
+  int64_t duration;
+} ProbeCacheStream;
+
+typedef struct ProbeCache {
+  char format_name[64];
+  int64_t header_bytes;   // bytes the demuxer consumed to read its header
+  int64_t start_time;
+  int64_t duration;
+  int64_t bit_rate;
+  int nb_streams;
+  ProbeCacheStream *streams;
+} ProbeCache;
+
+/* return 0 and a cache entry if filename was probed before and is unchanged */
+int probecache_load(const char *filename, ProbeCache **pc);
+
+/* input format and avformat_open_input options for a cache hit */
+AVInputFormat *probecache_input_format(ProbeCache *pc);
+void probecache_open_options(ProbeCache *pc, AVDictionary **format_opts);
+
+/**
+ *  inject cached parameters into an opened context.
+ *  return 0 if avformat_find_stream_info can be skipped, otherwise the
+ *  probing limits are restored and the caller must probe as usual
+ */
+int probecache_apply(ProbeCache *pc, AVFormatContext *ic);
+
+int probecache_store(const char *filename, AVFormatContext *ic, int64_t header_bytes);
+void probecache_free(ProbeCache **pc);
+
+#endif
@@ -0,0 +1,142 @@
+extern "C" {
+  #include <libavutil/common.h>
+  #include <libavutil/log.h>
+  #include <libavutil/mem.h>
+}
+
+#include <SDL.h>
+
+#include "slicepool.h"
+
+struct SlicePool {
+  SDL_Thread **threads;
+  int nb_threads;
+  SDL_mutex *mutex;
+  SDL_cond *work_cond;
+  SDL_cond *done_cond;
+
+  /* current job, all under mutex */
+  SliceFunc fn;
+  void *arg;
+  int nb_slices;
+  int next_slice;
+  int pending;    // slices handed out or waiting, not finished yet
+  int busy;       // a caller is inside slicepool_run, others wait their turn
+  int quit;
+};
+
+/* run slices of the current job until none are left; called and returns with mutex held */
+static void slicepool_drain(SlicePool *pool)
+{
+  while (pool->next_slice < pool->nb_slices) {
+    int slice = pool->next_slice++;
+    SliceFunc fn = pool->fn;
+    void *arg = pool->arg;
+    int nb_slices = pool->nb_slices;
+
+    SDL_UnlockMutex(pool->mutex);
+    fn(arg, slice, nb_slices);
+    SDL_LockMutex(pool->mutex);
+    if (!--pool->pending)
+      SDL_CondBroadcast(pool->done_cond);
+  }
+}
+
+static int slicepool_worker(void *arg)
+{
+  SlicePool *pool = (SlicePool *)arg;
+
+  SDL_LockMutex(pool->mutex);
+  while (true) {
+    while (!pool->quit && pool->next_slice >= pool->nb_slices)
+      SDL_CondWait(pool->work_cond, pool->mutex);
+    if (pool->quit)
+      break;
+    slicepool_drain(pool);
+  }
+  SDL_UnlockMutex(pool->mutex);
+  return 0;
+}
+
+SlicePool *slicepool_create(int nb_threads)
+{
+  SlicePool *pool = (SlicePool *)av_mallocz(sizeof(*pool));
+  if (!pool)
+    return NULL;
+  if (!(pool->mutex = SDL_CreateMutex()) ||
+      !(pool->work_cond = SDL_CreateCond()) ||
+      !(pool->done_cond = SDL_CreateCond()) ||
+      !(pool->threads = (SDL_Thread **)av_mallocz_array(FFMAX(nb_threads, 1), sizeof(*pool->threads)))) {
+    av_log(NULL, AV_LOG_FATAL, "slicepool: %s\n", SDL_GetError());
+    slicepool_destroy(&pool);
+    return NULL;
+  }
+  for (int i = 0; i < nb_threads; i++) {
+    if (!(pool->threads[i] = SDL_CreateThread(slicepool_worker, "slice_worker", pool))) {
+      // fewer workers still work, the caller picks up the rest
+      av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+      break;
+    }
+    pool->nb_threads++;
+  }
+  return pool;
+}
+
+void slicepool_run(SlicePool *pool, SliceFunc fn, void *arg, int nb_slices)
+{
+  if (!pool || !pool->nb_threads || nb_slices <= 1) {
+    for (int i = 0; i < nb_slices; i++)
+      fn(arg, i, nb_slices);
+    return;
+  }
+
+  SDL_LockMutex(pool->mutex);
+  while (pool->busy)
+    SDL_CondWait(pool->done_cond, pool->mutex);
+  pool->busy = 1;
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->nb_slices = nb_slices;
+  pool->next_slice = 0;
+  pool->pending = nb_slices;
+  SDL_CondBroadcast(pool->work_cond);
+
+  slicepool_drain(pool);
+  while (pool->pending)
+    SDL_CondWait(pool->done_cond, pool->mutex);
+  pool->nb_slices = 0;
+  pool->next_slice = 0;
+  pool->busy = 0;
+  SDL_CondBroadcast(pool->done_cond);
+  SDL_UnlockMutex(pool->mutex);
+}
+
+int slicepool_threads(SlicePool *pool)
+{
+  return pool ? pool->nb_threads : 0;
+}
+
+void slicepool_destroy(SlicePool **ppool)
+{
+  SlicePool *pool = *ppool;
+  if (!pool)
+    return;
+
+  if (pool->mutex) {
+    SDL_LockMutex(pool->mutex);
+    pool->quit = 1;
+    SDL_CondBroadcast(pool->work_cond);
+    SDL_UnlockMutex(pool->mutex);
+  }
+  for (int i = 0; i < pool->nb_threads; i++)
+    SDL_WaitThread(pool->threads[i], NULL);
+
+  av_freep(&pool->threads);
+  if (pool->done_cond)
+    SDL_DestroyCond(pool->done_cond);
+  if (pool->work_cond)
+    SDL_DestroyCond(pool->work_cond);
+  if (pool->mutex)
+    SDL_DestroyMutex(pool->mutex);
+  av_freep(ppool);
+}
@@ -0,0 +1,20 @@
+#ifndef KSPLAYER_SLICEPOOL_H
+#define KSPLAYER_SLICEPOOL_H
+
+/**
+ *  small worker pool for slice-parallel frame work (color conversion, filters
+ *  on the display side). slicepool_run hands out slices to the workers and the
+ *  calling thread alike and returns when every slice is done. Callers on
+ *  several threads take turns.
+ */
+typedef struct SlicePool SlicePool;
+
+typedef void (*SliceFunc)(void *arg, int slice, int nb_slices);
+
+/* nb_threads workers in addition to the caller; 0 runs everything on the caller */
+SlicePool *slicepool_create(int nb_threads);
+void slicepool_run(SlicePool *pool, SliceFunc fn, void *arg, int nb_slices);
+int slicepool_threads(SlicePool *pool);
+void slicepool_destroy(SlicePool **pool);
+
+#endif
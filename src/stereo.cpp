@@ -0,0 +1,141 @@
+extern "C" {
+  #include <libavutil/common.h>
+  #include <libavutil/cpu.h>
+  #include <libavutil/error.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "stereo.h"
+
+/* BT.601 luma weights in Q7, summing to 128 */
+#define LUMA_WB 15
+#define LUMA_WG 75
+#define LUMA_WR 38
+
+typedef void (*AnaglyphRowFunc)(const uint8_t *left, const uint8_t *right, uint8_t *dst, int x, int width);
+
+/* reference kernel, also converts the tail pixels for the SIMD one; BGRA in memory */
+static void anaglyph_row_c(const uint8_t *left, const uint8_t *right, uint8_t *dst, int x, int width)
+{
+  for (; x < width; x++) {
+    const uint8_t *l = left + 4 * x, *r = right + 4 * x;
+    uint8_t *d = dst + 4 * x;
+    d[0] = r[0];
+    d[1] = r[1];
+    d[2] = (l[0] * LUMA_WB + l[1] * LUMA_WG + l[2] * LUMA_WR + 64) >> 7;
+    d[3] = 255;
+  }
+}
+
+#if HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void anaglyph_row_avx2(const uint8_t *left, const uint8_t *right, uint8_t *dst, int x, int width)
+{
+  const __m256i weights = _mm256_set1_epi32(LUMA_WB | LUMA_WG << 8 | LUMA_WR << 16);
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i gb = _mm256_set1_epi32(0x0000ffff);
+  const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+  const __m256i round = _mm256_set1_epi32(64);
+
+  for (; x + 8 <= width; x += 8) {
+    __m256i l = _mm256_loadu_si256((const __m256i *)(left + 4 * x));
+    __m256i r = _mm256_loadu_si256((const __m256i *)(right + 4 * x));
+    // (b * wb + g * wg, r * wr + a * 0) per pixel, then the two halves added
+    __m256i y = _mm256_madd_epi16(_mm256_maddubs_epi16(l, weights), ones);
+    y = _mm256_srli_epi32(_mm256_add_epi32(y, round), 7);
+    __m256i d = _mm256_or_si256(_mm256_and_si256(r, gb), _mm256_or_si256(_mm256_slli_epi32(y, 16), alpha));
+    _mm256_storeu_si256((__m256i *)(dst + 4 * x), d);
+  }
+  anaglyph_row_c(left, right, dst, x, width);
+}
+
+#endif
+
+typedef struct AnaglyphKernel {
+  const char *name;
+  AnaglyphRowFunc row;
+} AnaglyphKernel;
+
+static const AnaglyphKernel kernel_c = { "c", anaglyph_row_c };
+#if HAVE_X86_KERNELS
+static const AnaglyphKernel kernel_avx2 = { "avx2", anaglyph_row_avx2 };
+#endif
+
+static const AnaglyphKernel *select_kernel(void)
+{
+#if HAVE_X86_KERNELS
+  if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+    return &kernel_avx2;
+#endif
+  return &kernel_c;
+}
+
+static const AnaglyphKernel *get_kernel(void)
+{
+  static const AnaglyphKernel *kernel = select_kernel();
+  return kernel;
+}
+
+int stereo_supported(const AVStereo3D *s3d)
+{
+  return s3d && (s3d->type == AV_STEREO3D_SIDEBYSIDE || s3d->type == AV_STEREO3D_TOPBOTTOM);
+}
+
+StereoRect stereo_eye_rect(const AVStereo3D *s3d, int width, int height, int right)
+{
+  StereoRect rect = { 0, 0, width, height };
+  int second = !!right ^ !!(s3d->flags & AV_STEREO3D_FLAG_INVERT);
+
+  if (s3d->type == AV_STEREO3D_SIDEBYSIDE) {
+    rect.w = width / 2;
+    rect.x = second ? rect.w : 0;
+  }
+  else if (s3d->type == AV_STEREO3D_TOPBOTTOM) {
+    rect.h = height / 2;
+    rect.y = second ? rect.h : 0;
+  }
+  return rect;
+}
+
+AVRational stereo_eye_sar(const AVStereo3D *s3d, int width, int height, AVRational sar)
+{
+  if (!sar.num || !sar.den)
+    sar = av_make_q(1, 1);
+  double dar = height ? width * av_q2d(sar) / height : 1;
+
+  if (s3d->type == AV_STEREO3D_SIDEBYSIDE && dar < 2.5)
+    return av_mul_q(sar, av_make_q(2, 1));
+  if (s3d->type == AV_STEREO3D_TOPBOTTOM && dar > 1.0)
+    return av_mul_q(sar, av_make_q(1, 2));
+  return sar;
+}
+
+int stereo_anaglyph(const AVStereo3D *s3d, const uint8_t *src, int src_linesize, int width, int height,
+                    uint8_t *dst, int dst_linesize, int y_start, int y_end)
+{
+  if (!stereo_supported(s3d))
+    return AVERROR(ENOSYS);
+
+  StereoRect l = stereo_eye_rect(s3d, width, height, 0);
+  StereoRect r = stereo_eye_rect(s3d, width, height, 1);
+  AnaglyphRowFunc row = get_kernel()->row;
+
+  y_end = FFMIN(y_end, l.h);
+  for (int y = y_start; y < y_end; y++)
+    row(src + (ptrdiff_t)(l.y + y) * src_linesize + 4 * l.x,
+        src + (ptrdiff_t)(r.y + y) * src_linesize + 4 * r.x,
+        dst + (ptrdiff_t)y * dst_linesize, 0, l.w);
+  return 0;
+}
+
+const char *stereo_kernel_name(void)
+{
+  return get_kernel()->name;
+}
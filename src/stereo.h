@@ -0,0 +1,43 @@
+#ifndef KSPLAYER_STEREO_H
+#define KSPLAYER_STEREO_H
+
+extern "C" {
+  #include <libavutil/rational.h>
+  #include <libavutil/stereo3d.h>
+}
+
+/**
+ *  side-by-side and top-bottom packed stereo pictures. A single eye is a source
+ *  rectangle of the decoded picture, so showing one costs nothing. The anaglyph
+ *  is the one mode that touches pixels: half-color red/cyan from two BGRA eyes,
+ *  red from the left eye's luma (less retinal rivalry than its plain red) and
+ *  green and blue from the right eye. Scalar and AVX2 kernels are bit exact.
+ */
+typedef struct StereoRect {
+  int x, y, w, h;
+} StereoRect;
+
+/* packings we can take apart */
+int stereo_supported(const AVStereo3D *s3d);
+
+/* where one eye sits in a width x height picture */
+StereoRect stereo_eye_rect(const AVStereo3D *s3d, int width, int height, int right);
+
+/**
+ *  aspect of an eye's samples. Frame-compatible packings squeeze each eye into
+ *  half the picture and are shown at the picture's aspect; full resolution ones
+ *  (a 32:9 side-by-side, a 8:9 top-bottom) keep the samples' own
+ */
+AVRational stereo_eye_sar(const AVStereo3D *s3d, int width, int height, AVRational sar);
+
+/**
+ *  anaglyph rows [y_start, y_end) of the eye sized dst from the packed BGRA picture
+ *  src; dst points at row 0. Row ranges may be converted concurrently
+ */
+int stereo_anaglyph(const AVStereo3D *s3d, const uint8_t *src, int src_linesize, int width, int height,
+                    uint8_t *dst, int dst_linesize, int y_start, int y_end);
+
+/* name of the kernel in use, for logs */
+const char *stereo_kernel_name(void);
+
+#endif
@@ -0,0 +1,138 @@
+extern "C" {
+  #include <libavutil/log.h>
+  #include <libavutil/mem.h>
+  #include <libavutil/time.h>
+}
+
+#include <string.h>
+
+#include "texpool.h"
+
+#define TEXPOOL_STATS_PERIOD 60000000
+
+static size_t texture_bytes(Uint32 format, int width, int height)
+{
+  // planar yuv fourccs report 1 byte per pixel, their chroma planes come on top
+  if (SDL_ISPIXELFORMAT_FOURCC(format) && SDL_BYTESPERPIXEL(format) == 1)
+    return (size_t)width * height * 3 / 2;
+  return (size_t)width * height * SDL_BYTESPERPIXEL(format);
+}
+
+static void texpool_log_stats(TexturePool *pool, int64_t now)
+{
+  if (!pool->stats_start) {
+    pool->stats_start = now;
+    return;
+  }
+  if (now - pool->stats_start < TEXPOOL_STATS_PERIOD)
+    return;
+  double minutes = (now - pool->stats_start) / 60000000.0;
+  av_log(NULL, AV_LOG_INFO, "texture pool: %.1f allocations/min, %.1f reuses/min, %d textures, %.1f MiB\n",
+         pool->allocations / minutes, pool->reuses / minutes, pool->nb_entries, pool->bytes / 1048576.0);
+  pool->stats_start = now;
+  pool->allocations = 0;
+  pool->reuses = 0;
+}
+
+static void texpool_remove(TexturePool *pool, int i)
+{
+  SDL_DestroyTexture(pool->entries[i].texture);
+  pool->bytes -= pool->entries[i].bytes;
+  pool->entries[i] = pool->entries[--pool->nb_entries];
+}
+
+/* drop idle textures, oldest first, until another extra bytes fit the budget */
+static void texpool_evict(TexturePool *pool, size_t extra)
+{
+  while (pool->bytes + extra > pool->budget) {
+    int oldest = -1;
+    for (int i = 0; i < pool->nb_entries; i++) {
+      TexturePoolEntry *e = &pool->entries[i];
+      if (!e->in_use && (oldest < 0 || e->last_used < pool->entries[oldest].last_used))
+        oldest = i;
+    }
+    if (oldest < 0)
+      return;   // everything is on screen or being written, go over budget
+    texpool_remove(pool, oldest);
+  }
+}
+
+void texpool_init(TexturePool *pool, SDL_Renderer *renderer, size_t budget)
+{
+  memset(pool, 0, sizeof(*pool));
+  pool->renderer = renderer;
+  pool->budget = budget;
+}
+
+SDL_Texture *texpool_acquire(TexturePool *pool, Uint32 format, int width, int height, SDL_BlendMode blendmode)
+{
+  int64_t now = av_gettime_relative();
+  TexturePoolEntry *e;
+
+  texpool_log_stats(pool, now);
+
+  for (int i = 0; i < pool->nb_entries; i++) {
+    e = &pool->entries[i];
+    if (!e->in_use && e->format == format && e->width == width && e->height == height) {
+      e->in_use = 1;
+      e->last_used = now;
+      pool->reuses++;
+      SDL_SetTextureBlendMode(e->texture, blendmode);
+      return e->texture;
+    }
+  }
+
+  size_t bytes = texture_bytes(format, width, height);
+  texpool_evict(pool, bytes);
+
+  TexturePoolEntry *entries = (TexturePoolEntry *)av_realloc_array(pool->entries, pool->nb_entries + 1, sizeof(*entries));
+  if (!entries)
+    return NULL;
+  pool->entries = entries;
+
+  SDL_Texture *texture = SDL_CreateTexture(pool->renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (!texture) {
+    av_log(NULL, AV_LOG_FATAL, "Failed to create %dx%d texture: %s\n", width, height, SDL_GetError());
+    return NULL;
+  }
+  if (SDL_SetTextureBlendMode(texture, blendmode) < 0) {
+    SDL_DestroyTexture(texture);
+    return NULL;
+  }
+  av_log(NULL, AV_LOG_VERBOSE, "Created %dx%d texture with %s.\n", width, height, SDL_GetPixelFormatName(format));
+
+  e = &pool->entries[pool->nb_entries++];
+  e->texture = texture;
+  e->format = format;
+  e->width = width;
+  e->height = height;
+  e->bytes = bytes;
+  e->last_used = now;
+  e->in_use = 1;
+  pool->bytes += bytes;
+  pool->allocations++;
+  return texture;
+}
+
+void texpool_release(TexturePool *pool, SDL_Texture *texture)
+{
+  if (!texture)
+    return;
+  for (int i = 0; i < pool->nb_entries; i++) {
+    if (pool->entries[i].texture == texture) {
+      pool->entries[i].in_use = 0;
+      pool->entries[i].last_used = av_gettime_relative();
+      texpool_evict(pool, 0);
+      return;
+    }
+  }
+  // not ours (created before the pool existed)
+  SDL_DestroyTexture(texture);
+}
+
+void texpool_uninit(TexturePool *pool)
+{
+  while (pool->nb_entries)
+    texpool_remove(pool, pool->nb_entries - 1);
+  av_freep(&pool->entries);
+}
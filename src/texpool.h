@@ -0,0 +1,44 @@
+#ifndef KSPLAYER_TEXPOOL_H
+#define KSPLAYER_TEXPOOL_H
+
+#include <SDL.h>
+
+/**
+ *  streaming textures reused across frames and resolution changes, keyed by
+ *  (width, height, SDL pixel format). Idle textures are evicted least recently
+ *  used first once the pool exceeds its byte budget. Render thread only.
+ */
+typedef struct TexturePoolEntry {
+  SDL_Texture *texture;
+  Uint32 format;
+  int width, height;
+  size_t bytes;
+  int64_t last_used;
+  int in_use;
+} TexturePoolEntry;
+
+typedef struct TexturePool {
+  SDL_Renderer *renderer;
+  TexturePoolEntry *entries;
+  int nb_entries;
+  size_t bytes;
+  size_t budget;
+
+  /* statistics, logged once a minute */
+  int64_t stats_start;
+  int allocations;
+  int reuses;
+} TexturePool;
+
+void texpool_init(TexturePool *pool, SDL_Renderer *renderer, size_t budget);
+
+/**
+ *  take an idle texture matching the key, or create one. Double buffering is
+ *  up to the caller: as long as the texture on screen is not released, it is
+ *  never handed out for the next upload
+ */
+SDL_Texture *texpool_acquire(TexturePool *pool, Uint32 format, int width, int height, SDL_BlendMode blendmode);
+void texpool_release(TexturePool *pool, SDL_Texture *texture);
+void texpool_uninit(TexturePool *pool);
+
+#endif
@@ -0,0 +1,306 @@
+extern "C" {
+  #include <libavutil/cpu.h>
+  #include <libavutil/error.h>
+  #include <libavutil/log.h>
+  #include <libavutil/mastering_display_metadata.h>
+  #include <libavutil/pixdesc.h>
+}
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "tonemap.h"
+
+#define SDR_WHITE_NITS      203.0   // BT.2408 HDR reference white, shown as SDR 100%
+#define PQ_DEFAULT_PEAK     1000.0  // no metadata: what most HDR10 grades are mastered to
+#define HLG_PEAK            1000.0
+
+/* per frame: how to get from samples to normalized R'G'B' */
+typedef struct TonemapCoeffs {
+  float yoff, yscale;
+  float coff, cscale;
+  float crv, cgu, cgv, cbu;
+  float gamut[3][3];    // linear source primaries -> BT.709
+  int shift;            // P010 keeps its samples in the high bits
+} TonemapCoeffs;
+
+static const float gamut_2020_to_709[3][3] = {
+  {  1.6605f, -0.5876f, -0.0728f },
+  { -0.1246f,  1.1329f, -0.0083f },
+  { -0.0182f, -0.1006f,  1.1187f },
+};
+
+static const float gamut_identity[3][3] = {
+  { 1.0f, 0.0f, 0.0f },
+  { 0.0f, 1.0f, 0.0f },
+  { 0.0f, 0.0f, 1.0f },
+};
+
+typedef void (*TonemapRowFunc)(const uint16_t *y, const uint16_t *u, const uint16_t *v, uint8_t *dst,
+                               int x, int width, const TonemapContext *ctx, const TonemapCoeffs *c);
+
+static double pq_eotf(double v)   // SMPTE ST 2084, nits
+{
+  const double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128;
+  const double c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32, c3 = 2392.0 / 4096 * 32;
+  double p = pow(v, 1.0 / m2);
+  return 10000.0 * pow(FFMAX(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+}
+
+static double hlg_eotf(double v)  // ARIB STD-B67 inverse OETF, then the OOTF per channel, nits
+{
+  const double a = 0.17883277, b = 0.28466892, c = 0.55991073;
+  double e = v <= 0.5 ? v * v / 3.0 : (exp((v - c) / a) + b) / 12.0;
+  return HLG_PEAK * pow(e, 1.2);
+}
+
+static double hable(double x)
+{
+  const double a = 0.15, b = 0.50, c = 0.10, d = 0.20, e = 0.02, f = 0.30;
+  return (x * (x * a + b * c) + d * e) / (x * (x * a + b) + d * f) - e / f;
+}
+
+static void tonemap_build_luts(TonemapContext *ctx)
+{
+  double peak = ctx->peak / SDR_WHITE_NITS;
+
+  for (int i = 0; i < TONEMAP_LUT_SIZE; i++) {
+    double v = (double)i / (TONEMAP_LUT_SIZE - 1);
+    double l = (ctx->trc == AVCOL_TRC_SMPTE2084 ? pq_eotf(v) : hlg_eotf(v)) / SDR_WHITE_NITS;
+    double t = peak <= 1.0 ? l : hable(l) / hable(peak);
+    ctx->eotf[i] = l;
+    ctx->scale[i] = l > 0 ? FFMIN(t, 1.0) / l : 0;
+    // indexed by sqrt(linear) so the darks get as many entries as the highlights
+    ctx->oetf[i] = lrint(255.0 * pow(v * v, 1.0 / 2.4));
+  }
+}
+
+static void tonemap_coeffs(const AVFrame *frame, TonemapCoeffs *c)
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat)frame->format);
+  int depth = desc->comp[0].depth;
+  int full = frame->color_range == AVCOL_RANGE_JPEG;
+  double kr = 0.2627, kb = 0.0593;    // HDR is BT.2020 unless tagged otherwise
+
+  if (frame->colorspace == AVCOL_SPC_BT709) {
+    kr = 0.2126;
+    kb = 0.0722;
+  }
+  double kg = 1.0 - kr - kb;
+
+  c->shift = desc->comp[0].shift;
+  c->yoff = full ? 0 : 16 << (depth - 8);
+  c->yscale = 1.0 / (full ? (1 << depth) - 1 : 219 << (depth - 8));
+  c->coff = 128 << (depth - 8);
+  c->cscale = 1.0 / (full ? (1 << depth) - 1 : 224 << (depth - 8));
+  c->crv = 2 * (1 - kr);
+  c->cgu = 2 * (1 - kb) * kb / kg;
+  c->cgv = 2 * (1 - kr) * kr / kg;
+  c->cbu = 2 * (1 - kb);
+  memcpy(c->gamut, frame->color_primaries == AVCOL_PRI_BT709 ? gamut_identity : gamut_2020_to_709, sizeof(c->gamut));
+}
+
+static inline int lut_index(float v)
+{
+  return lrintf(fminf(fmaxf(v, 0.0f), 1.0f) * (TONEMAP_LUT_SIZE - 1));
+}
+
+/* reference kernel, also does the tail columns for the SIMD one; same operations in the same order */
+static inline uint32_t tonemap_px(float yv, float uv, float vv, const TonemapContext *ctx, const TonemapCoeffs *c)
+{
+  float y = (yv - c->yoff) * c->yscale;
+  float u = (uv - c->coff) * c->cscale;
+  float v = (vv - c->coff) * c->cscale;
+  int ir = lut_index(y + c->crv * v);
+  int ig = lut_index(y - c->cgu * u - c->cgv * v);
+  int ib = lut_index(y + c->cbu * u);
+  float s = ctx->scale[FFMAX(ir, FFMAX(ig, ib))];
+  float r = ctx->eotf[ir] * s, g = ctx->eotf[ig] * s, b = ctx->eotf[ib] * s;
+  int32_t out[3];
+  for (int i = 0; i < 3; i++) {
+    float l = c->gamut[i][0] * r + c->gamut[i][1] * g + c->gamut[i][2] * b;
+    out[i] = ctx->oetf[lut_index(sqrtf(fminf(fmaxf(l, 0.0f), 1.0f)))];
+  }
+  return out[2] | out[1] << 8 | out[0] << 16 | 0xffu << 24;
+}
+
+template <bool P010>
+static void tonemap_row_c(const uint16_t *y, const uint16_t *u, const uint16_t *v, uint8_t *dst,
+                          int x, int width, const TonemapContext *ctx, const TonemapCoeffs *c)
+{
+  uint32_t *out = (uint32_t *)dst;
+  for (; x < width; x++) {
+    int cx = x >> 1;
+    uint16_t us = P010 ? u[2 * cx] : u[cx];
+    uint16_t vs = P010 ? u[2 * cx + 1] : v[cx];
+    out[x] = tonemap_px(y[x] >> c->shift, us >> c->shift, vs >> c->shift, ctx, c);
+  }
+}
+
+#if HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static inline __m256i lut_index_avx2(__m256 v)
+{
+  v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+  return _mm256_cvtps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(TONEMAP_LUT_SIZE - 1)));
+}
+
+template <bool P010>
+__attribute__((target("avx2")))
+static void tonemap_row_avx2(const uint16_t *y, const uint16_t *u, const uint16_t *v, uint8_t *dst,
+                             int x, int width, const TonemapContext *ctx, const TonemapCoeffs *c)
+{
+  const __m128i shift = _mm_cvtsi32_si128(c->shift);
+  const __m256 yoff = _mm256_set1_ps(c->yoff), yscale = _mm256_set1_ps(c->yscale);
+  const __m256 coff = _mm256_set1_ps(c->coff), cscale = _mm256_set1_ps(c->cscale);
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+  for (; x + 8 <= width; x += 8) {
+    __m256i yi = _mm256_srl_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(y + x))), shift);
+    __m256i ui, vi;
+    if (P010) {
+      // 4 interleaved u/v pairs, each pair for 2 pixels
+      __m256i uv = _mm256_srl_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(u + x))), shift);
+      ui = _mm256_permutevar8x32_epi32(uv, _mm256_setr_epi32(0, 0, 2, 2, 4, 4, 6, 6));
+      vi = _mm256_permutevar8x32_epi32(uv, _mm256_setr_epi32(1, 1, 3, 3, 5, 5, 7, 7));
+    }
+    else {
+      const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+      ui = _mm256_permutevar8x32_epi32(_mm256_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(u + (x >> 1)))), dup);
+      vi = _mm256_permutevar8x32_epi32(_mm256_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(v + (x >> 1)))), dup);
+    }
+
+    __m256 yf = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(yi), yoff), yscale);
+    __m256 uf = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(ui), coff), cscale);
+    __m256 vf = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(vi), coff), cscale);
+    __m256i ir = lut_index_avx2(_mm256_add_ps(yf, _mm256_mul_ps(_mm256_set1_ps(c->crv), vf)));
+    __m256i ig = lut_index_avx2(_mm256_sub_ps(_mm256_sub_ps(yf, _mm256_mul_ps(_mm256_set1_ps(c->cgu), uf)),
+                                              _mm256_mul_ps(_mm256_set1_ps(c->cgv), vf)));
+    __m256i ib = lut_index_avx2(_mm256_add_ps(yf, _mm256_mul_ps(_mm256_set1_ps(c->cbu), uf)));
+
+    // tone curve on the brightest channel, the same ratio applied to all three
+    __m256 s = _mm256_i32gather_ps(ctx->scale, _mm256_max_epi32(ir, _mm256_max_epi32(ig, ib)), 4);
+    __m256 r = _mm256_mul_ps(_mm256_i32gather_ps(ctx->eotf, ir, 4), s);
+    __m256 g = _mm256_mul_ps(_mm256_i32gather_ps(ctx->eotf, ig, 4), s);
+    __m256 b = _mm256_mul_ps(_mm256_i32gather_ps(ctx->eotf, ib, 4), s);
+
+    __m256i out[3];
+    for (int i = 0; i < 3; i++) {
+      __m256 l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(c->gamut[i][0]), r),
+                                             _mm256_mul_ps(_mm256_set1_ps(c->gamut[i][1]), g)),
+                               _mm256_mul_ps(_mm256_set1_ps(c->gamut[i][2]), b));
+      l = _mm256_sqrt_ps(_mm256_min_ps(_mm256_max_ps(l, zero), one));
+      out[i] = _mm256_i32gather_epi32((const int *)ctx->oetf, lut_index_avx2(l), 4);
+    }
+    __m256i px = _mm256_or_si256(_mm256_or_si256(out[2], _mm256_slli_epi32(out[1], 8)),
+                                 _mm256_or_si256(_mm256_slli_epi32(out[0], 16), _mm256_set1_epi32((int)0xff000000)));
+    _mm256_storeu_si256((__m256i *)(dst + 4 * x), px);
+  }
+  tonemap_row_c<P010>(y, u, v, dst, x, width, ctx, c);
+}
+
+#endif
+
+/* [p010] */
+typedef struct TonemapKernels {
+  const char *name;
+  TonemapRowFunc row[2];
+} TonemapKernels;
+
+static const TonemapKernels kernels_c = { "c", { tonemap_row_c<false>, tonemap_row_c<true> } };
+
+#if HAVE_X86_KERNELS
+static const TonemapKernels kernels_avx2 = { "avx2", { tonemap_row_avx2<false>, tonemap_row_avx2<true> } };
+#endif
+
+static const TonemapKernels *get_kernels(void)
+{
+#if HAVE_X86_KERNELS
+  static const TonemapKernels *kernels = av_get_cpu_flags() & AV_CPU_FLAG_AVX2 ? &kernels_avx2 : &kernels_c;
+#else
+  static const TonemapKernels *kernels = &kernels_c;
+#endif
+  return kernels;
+}
+
+int tonemap_supported(const AVFrame *frame)
+{
+  return (frame->color_trc == AVCOL_TRC_SMPTE2084 || frame->color_trc == AVCOL_TRC_ARIB_STD_B67) &&
+         (frame->format == AV_PIX_FMT_YUV420P10LE || frame->format == AV_PIX_FMT_YUV420P12LE ||
+          frame->format == AV_PIX_FMT_P010LE);
+}
+
+int tonemap_update(TonemapContext *ctx, const AVFrame *frame)
+{
+  AVFrameSideData *sd;
+  double peak;
+
+  if (!tonemap_supported(frame))
+    return AVERROR(ENOSYS);
+
+  if ((sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA))) {
+    const AVMasteringDisplayMetadata *mdm = (const AVMasteringDisplayMetadata *)sd->data;
+    if (mdm->has_luminance)
+      ctx->max_luminance = av_q2d(mdm->max_luminance);
+  }
+  if ((sd = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL))) {
+    const AVContentLightMetadata *cll = (const AVContentLightMetadata *)sd->data;
+    if (cll->MaxCLL)
+      ctx->max_cll = cll->MaxCLL;
+  }
+
+  // what the content actually reaches beats what the mastering display could do
+  if (frame->color_trc == AVCOL_TRC_ARIB_STD_B67)
+    peak = HLG_PEAK;
+  else if (ctx->max_cll > 0)
+    peak = ctx->max_cll;
+  else if (ctx->max_luminance > 0)
+    peak = ctx->max_luminance;
+  else
+    peak = PQ_DEFAULT_PEAK;
+
+  if (ctx->ready && ctx->trc == frame->color_trc && ctx->peak == peak)
+    return 0;
+  ctx->trc = frame->color_trc;
+  ctx->peak = peak;
+  tonemap_build_luts(ctx);
+  ctx->ready = 1;
+  av_log(NULL, AV_LOG_INFO, "tone mapping %s, peak %.0f nits -> SDR (%s)\n",
+         av_color_transfer_name((enum AVColorTransferCharacteristic)ctx->trc), peak, get_kernels()->name);
+  return 0;
+}
+
+int tonemap_convert(const TonemapContext *ctx, const AVFrame *src, uint8_t *dst, int dst_linesize,
+                    int y_start, int y_end)
+{
+  TonemapCoeffs c;
+  int p010 = src->format == AV_PIX_FMT_P010LE;
+  TonemapRowFunc row = get_kernels()->row[p010];
+
+  if (!ctx->ready || !tonemap_supported(src))
+    return AVERROR(EINVAL);
+  tonemap_coeffs(src, &c);
+
+  y_end = FFMIN(y_end, src->height);
+  for (int y = y_start; y < y_end; y++) {
+    int cy = y >> 1;
+    row((const uint16_t *)(src->data[0] + (ptrdiff_t)y * src->linesize[0]),
+        (const uint16_t *)(src->data[1] + (ptrdiff_t)cy * src->linesize[1]),
+        p010 ? NULL : (const uint16_t *)(src->data[2] + (ptrdiff_t)cy * src->linesize[2]),
+        dst + (ptrdiff_t)y * dst_linesize, 0, src->width, ctx, &c);
+  }
+  return 0;
+}
+
+const char *tonemap_kernel_name(void)
+{
+  return get_kernels()->name;
+}
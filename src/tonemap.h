@@ -0,0 +1,46 @@
+#ifndef KSPLAYER_TONEMAP_H
+#define KSPLAYER_TONEMAP_H
+
+extern "C" {
+  #include <libavutil/frame.h>
+}
+
+/**
+ *  HDR10 (PQ) and HLG -> SDR BT.709 BGRA on the CPU, for 10/12-bit 4:2:0 frames.
+ *  Per pixel: YCbCr -> R'G'B', 1D LUTs for the EOTF and for a Hable curve applied
+ *  to the brightest channel (hue stays put), BT.2020 -> BT.709 gamut, and a LUT
+ *  for the BT.1886 encode. The LUTs are rebuilt only when the source peak from
+ *  the mastering display / content light level side data or the tagging changes.
+ *  The AVX2 kernel gathers from the LUTs 8 pixels at a time
+ */
+#define TONEMAP_LUT_BITS 12
+#define TONEMAP_LUT_SIZE (1 << TONEMAP_LUT_BITS)
+
+typedef struct TonemapContext {
+  /* what the LUTs were built for */
+  int trc;
+  double peak;          // source peak, nits
+  int ready;
+
+  /* metadata comes with keyframes only, it holds until the next one */
+  double max_luminance; // mastering display, nits
+  double max_cll;       // content light level, nits
+
+  float eotf[TONEMAP_LUT_SIZE];     // signal -> linear, 1.0 = SDR white
+  float scale[TONEMAP_LUT_SIZE];    // max channel signal -> tone mapped / linear
+  int32_t oetf[TONEMAP_LUT_SIZE];   // sqrt(linear) -> 8-bit code
+} TonemapContext;
+
+/* PQ or HLG transfer in a layout the kernels read */
+int tonemap_supported(const AVFrame *frame);
+
+/* pick up side data and rebuild the LUTs if needed; once per frame, before the slices */
+int tonemap_update(TonemapContext *ctx, const AVFrame *frame);
+
+/* rows [y_start, y_end) of src into BGRA dst, which points at row 0; slices may run concurrently */
+int tonemap_convert(const TonemapContext *ctx, const AVFrame *src, uint8_t *dst, int dst_linesize,
+                    int y_start, int y_end);
+
+const char *tonemap_kernel_name(void);
+
+#endif
@@ -0,0 +1,373 @@
+extern "C" {
+  #include <libavutil/common.h>
+  #include <libavutil/cpu.h>
+  #include <libavutil/error.h>
+  #include <libavutil/mathematics.h>
+  #include <libavutil/mem.h>
+}
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "viewport.h"
+
+#define VIEWPORT_FOV_MIN  30.0
+#define VIEWPORT_FOV_MAX  150.0
+
+/**
+ *  bilinear sample of an 8-bit plane, step bytes between samples (2 for nv12 chroma):
+ *    top = p00 * (128 - fx) + p01 * fx       <= 255 * 128, fits int16
+ *    out = (top * (128 - fy) + bottom * fy + 8192) >> 14
+ *  No table entry starts on the last column or row (the last column is p01 of
+ *  the one before at fx 128), so only samples of the plane are read and frames
+ *  need no padding; filter graph and hwdownload output has none guaranteed.
+ *  row_bytes is how many bytes of each row may be read from src on
+ */
+typedef void (*RemapRowFunc)(const uint8_t *src, int linesize, int step, int row_bytes, const int32_t *xy,
+                             const uint16_t *w, uint8_t *dst, int x, int n);
+typedef void (*BuildRowFunc)(const Viewport *vp, int32_t *xy, uint16_t *w, int j, int i, int n, int scale,
+                             int src_w, int src_h);
+
+/* reference kernel, also samples the tail for the SIMD one */
+static void remap_row_c(const uint8_t *src, int linesize, int step, int, const int32_t *xy,
+                        const uint16_t *w, uint8_t *dst, int x, int n)
+{
+  for (; x < n; x++) {
+    const uint8_t *p = src + (ptrdiff_t)(xy[x] >> 16) * linesize + (xy[x] & 0xffff) * step;
+    int fx = w[x] & 0xff, fy = w[x] >> 8;
+    int top = p[0] * (128 - fx) + p[step] * fx;
+    int bottom = p[linesize] * (128 - fx) + p[linesize + step] * fx;
+    dst[x] = (top * (128 - fy) + bottom * fy + 8192) >> 14;
+  }
+}
+
+/* atan2 to about 1e-5 rad (a hundredth of a 4K source pixel), several times faster than libm's */
+static inline float fast_atan2f(float y, float x)
+{
+  float ax = fabsf(x), ay = fabsf(y);
+  float a = FFMIN(ax, ay) / FFMAX(FFMAX(ax, ay), 1e-30f);
+  float s = a * a;
+  float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+  if (ay > ax)
+    r = (float)M_PI_2 - r;
+  if (x < 0)
+    r = (float)M_PI - r;
+  return y < 0 ? -r : r;
+}
+
+/**
+ *  table row j of a plane with n samples per row from sample i on, scale output
+ *  pixels per sample (2 for chroma), into a source plane of src_w x src_h.
+ *  Reference for the SIMD builder, which does the same float operations in the
+ *  same order and so builds the same table
+ */
+static void viewport_build_row_c(const Viewport *vp, int32_t *xy, uint16_t *w, int j, int i, int n, int scale,
+                                 int src_w, int src_h)
+{
+  const float *m = vp->m;
+  float y = (j + 0.5f) * scale - vp->dst_h * 0.5f;
+  float z = vp->focal;
+
+  for (; i < n; i++) {
+    float x = (i + 0.5f) * scale - vp->dst_w * 0.5f;
+    float dx = m[0] * x + m[1] * y + m[2] * z;
+    float dy = m[3] * x + m[4] * y + m[5] * z;
+    float dz = m[6] * x + m[7] * y + m[8] * z;
+    float lon = fast_atan2f(dx, dz);
+    float lat = fast_atan2f(-dy, sqrtf(dx * dx + dz * dz));
+
+    // sample centres sit at +0.5
+    float u = (lon * (float)(0.5 / M_PI) + 0.5f) * src_w - 0.5f;
+    float v = av_clipf((0.5f - lat * (float)(1.0 / M_PI)) * src_h - 0.5f, 0, src_h - 1);
+    int x0 = (int)floorf(u), y0 = FFMIN((int)v, src_h - 2);
+    int fx = (int)((u - x0) * 128 + 0.5f), fy = (int)((v - y0) * 128 + 0.5f);
+    if (fx == 128) {
+      x0++;
+      fx = 0;
+    }
+    // u is within half a sample of the plane, one wrap is enough
+    if (x0 < 0)
+      x0 += src_w;
+    else if (x0 >= src_w)
+      x0 -= src_w;
+    if (x0 == src_w - 1) {
+      x0--;       // the seam: no neighbour to its right in this row, take it as the one before's
+      fx = 128;
+    }
+    xy[i] = x0 | y0 << 16;
+    w[i] = fx | fy << 8;
+  }
+}
+
+#if HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void remap_row_avx2(const uint8_t *src, int linesize, int step, int row_bytes, const int32_t *xy,
+                           const uint16_t *w, uint8_t *dst, int x, int n)
+{
+  const __m256i ls = _mm256_set1_epi32(linesize);
+  const __m256i lo16 = _mm256_set1_epi32(0xffff);
+  const __m256i lo8 = _mm256_set1_epi32(0xff);
+  const __m256i c128 = _mm256_set1_epi32(128);
+  const __m128i step_shift = _mm_cvtsi32_si128(step == 2 ? 1 : 0);
+  const __m128i next_shift = _mm_cvtsi32_si128(8 * step);
+  const __m256i order = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+  // the last column whose 4-byte gather stays inside the row
+  const __m256i gather_max = _mm256_set1_epi32(row_bytes >= 4 ? (row_bytes - 4) / step : -1);
+
+  for (; x + 8 <= n; x += 8) {
+    __m256i pos = _mm256_loadu_si256((const __m256i *)(xy + x));
+    if (!_mm256_testz_si256(_mm256_cmpgt_epi32(_mm256_and_si256(pos, lo16), gather_max), _mm256_set1_epi32(-1))) {
+      remap_row_c(src, linesize, step, row_bytes, xy, w, dst, x, x + 8);
+      continue;
+    }
+    __m256i off = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(pos, 16), ls),
+                                   _mm256_sll_epi32(_mm256_and_si256(pos, lo16), step_shift));
+    // 4 bytes per sample: p00 in byte 0, p01 in byte step
+    __m256i g0 = _mm256_i32gather_epi32((const int *)src, off, 1);
+    __m256i g1 = _mm256_i32gather_epi32((const int *)(src + linesize), off, 1);
+
+    __m256i wt = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(w + x)));
+    __m256i fx = _mm256_and_si256(wt, lo8);
+    __m256i fy = _mm256_srli_epi32(wt, 8);
+    __m256i wx = _mm256_or_si256(_mm256_sub_epi32(c128, fx), _mm256_slli_epi32(fx, 16));
+    __m256i wy = _mm256_or_si256(_mm256_sub_epi32(c128, fy), _mm256_slli_epi32(fy, 16));
+
+    // (p00, p01) pairs against (128 - fx, fx) pairs, one madd per row
+    __m256i t0 = _mm256_or_si256(_mm256_and_si256(g0, lo8), _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(g0, next_shift), lo8), 16));
+    __m256i t1 = _mm256_or_si256(_mm256_and_si256(g1, lo8), _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(g1, next_shift), lo8), 16));
+    __m256i top = _mm256_madd_epi16(t0, wx);
+    __m256i bottom = _mm256_madd_epi16(t1, wx);
+    __m256i v = _mm256_madd_epi16(_mm256_or_si256(top, _mm256_slli_epi32(bottom, 16)), wy);
+    v = _mm256_srli_epi32(_mm256_add_epi32(v, _mm256_set1_epi32(8192)), 14);
+
+    v = _mm256_packus_epi32(v, v);
+    v = _mm256_packus_epi16(v, v);
+    v = _mm256_permutevar8x32_epi32(v, order);
+    _mm_storel_epi64((__m128i *)(dst + x), _mm256_castsi256_si128(v));
+  }
+  remap_row_c(src, linesize, step, row_bytes, xy, w, dst, x, n);
+}
+
+/* 8 lanes of fast_atan2f */
+__attribute__((target("avx2")))
+static inline __m256 fast_atan2_avx2(__m256 y, __m256 x)
+{
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 ax = _mm256_andnot_ps(sign, x), ay = _mm256_andnot_ps(sign, y);
+  __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f)));
+  __m256 s = _mm256_mul_ps(a, a);
+  __m256 r = _mm256_add_ps(_mm256_set1_ps(0.05265332f), _mm256_mul_ps(s, _mm256_set1_ps(-0.01172120f)));
+  r = _mm256_add_ps(_mm256_set1_ps(-0.11643287f), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(0.19354346f), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(-0.33262347f), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(0.99997726f), _mm256_mul_ps(s, r));
+  r = _mm256_mul_ps(a, r);
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)M_PI_2), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)M_PI), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+  return _mm256_xor_ps(r, _mm256_and_ps(sign, _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ)));
+}
+
+__attribute__((target("avx2")))
+static void viewport_build_row_avx2(const Viewport *vp, int32_t *xy, uint16_t *w, int j, int i, int n, int scale,
+                                    int src_w, int src_h)
+{
+  const float *m = vp->m;
+  float y = (j + 0.5f) * scale - vp->dst_h * 0.5f;
+  float z = vp->focal;
+  const __m256 my[3] = { _mm256_set1_ps(m[1] * y), _mm256_set1_ps(m[4] * y), _mm256_set1_ps(m[7] * y) };
+  const __m256 mz[3] = { _mm256_set1_ps(m[2] * z), _mm256_set1_ps(m[5] * z), _mm256_set1_ps(m[8] * z) };
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 fw = _mm256_set1_ps((float)src_w), fh = _mm256_set1_ps((float)src_h);
+  const __m256 c128 = _mm256_set1_ps(128);
+  const __m256i w1 = _mm256_set1_epi32(src_w - 1), h2 = _mm256_set1_epi32(src_h - 2);
+  const __m256i i128 = _mm256_set1_epi32(128);
+
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    x = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(x, half), _mm256_set1_ps((float)scale)), _mm256_set1_ps(vp->dst_w * 0.5f));
+    __m256 dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0]), x), my[0]), mz[0]);
+    __m256 dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[3]), x), my[1]), mz[1]);
+    __m256 dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[6]), x), my[2]), mz[2]);
+    __m256 lon = fast_atan2_avx2(dx, dz);
+    __m256 lat = fast_atan2_avx2(_mm256_xor_ps(dy, _mm256_set1_ps(-0.0f)),
+                                 _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz))));
+
+    __m256 u = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(lon, _mm256_set1_ps((float)(0.5 / M_PI))), half), fw), half);
+    __m256 v = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(half, _mm256_mul_ps(lat, _mm256_set1_ps((float)(1.0 / M_PI)))), fh), half);
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps((float)(src_h - 1)));
+    __m256i x0 = _mm256_cvttps_epi32(_mm256_floor_ps(u));
+    __m256i y0 = _mm256_min_epi32(_mm256_cvttps_epi32(v), h2);
+    __m256i fx = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(u, _mm256_cvtepi32_ps(x0)), c128), half));
+    __m256i fy = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, _mm256_cvtepi32_ps(y0)), c128), half));
+
+    __m256i carry = _mm256_cmpeq_epi32(fx, i128);
+    x0 = _mm256_sub_epi32(x0, carry);
+    fx = _mm256_andnot_si256(carry, fx);
+    x0 = _mm256_add_epi32(x0, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), x0), _mm256_set1_epi32(src_w)));
+    x0 = _mm256_sub_epi32(x0, _mm256_and_si256(_mm256_cmpgt_epi32(x0, w1), _mm256_set1_epi32(src_w)));
+    __m256i seam = _mm256_cmpeq_epi32(x0, w1);
+    x0 = _mm256_add_epi32(x0, seam);
+    fx = _mm256_blendv_epi8(fx, i128, seam);
+
+    _mm256_storeu_si256((__m256i *)(xy + i), _mm256_or_si256(x0, _mm256_slli_epi32(y0, 16)));
+    __m256i wt = _mm256_or_si256(fx, _mm256_slli_epi32(fy, 8));
+    wt = _mm256_permute4x64_epi64(_mm256_packus_epi32(wt, wt), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(w + i), _mm256_castsi256_si128(wt));
+  }
+  viewport_build_row_c(vp, xy, w, j, i, n, scale, src_w, src_h);
+}
+
+#endif
+
+typedef struct RemapKernel {
+  const char *name;
+  RemapRowFunc row;
+  BuildRowFunc build;
+} RemapKernel;
+
+static const RemapKernel kernel_c = { "c", remap_row_c, viewport_build_row_c };
+#if HAVE_X86_KERNELS
+static const RemapKernel kernel_avx2 = { "avx2", remap_row_avx2, viewport_build_row_avx2 };
+#endif
+
+static const RemapKernel *select_kernel(void)
+{
+#if HAVE_X86_KERNELS
+  if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+    return &kernel_avx2;
+#endif
+  return &kernel_c;
+}
+
+static const RemapKernel *get_kernel(void)
+{
+  static const RemapKernel *kernel = select_kernel();
+  return kernel;
+}
+
+int viewport_supported(enum AVPixelFormat src)
+{
+  return src == AV_PIX_FMT_YUV420P || src == AV_PIX_FMT_YUVJ420P || src == AV_PIX_FMT_NV12;
+}
+
+void viewport_init(Viewport *vp, double yaw, double pitch)
+{
+  viewport_free(vp);
+  memset(vp, 0, sizeof(*vp));
+  vp->yaw = yaw;
+  vp->pitch = pitch;
+  vp->fov = VIEWPORT_FOV_DEFAULT;
+}
+
+int viewport_stale(const Viewport *vp, int src_w, int src_h, int dst_w, int dst_h)
+{
+  return !vp->xy[0] || vp->src_w != src_w || vp->src_h != src_h || vp->dst_w != dst_w || vp->dst_h != dst_h ||
+         vp->built_yaw != vp->yaw || vp->built_pitch != vp->pitch || vp->built_fov != vp->fov;
+}
+
+int viewport_update(Viewport *vp, const AVFrame *src, int dst_w, int dst_h)
+{
+  if (!viewport_supported((enum AVPixelFormat)src->format) || src->width < 4 || src->height < 4 ||
+      src->width > 0xffff || src->height > 0xffff || dst_w < 2 || dst_h < 2)
+    return AVERROR(ENOSYS);
+
+  vp->yaw = fmod(fmod(vp->yaw, 360.0) + 540.0, 360.0) - 180.0;
+  vp->pitch = av_clipd(vp->pitch, -VIEWPORT_PITCH_MAX, VIEWPORT_PITCH_MAX);
+  vp->fov = av_clipd(vp->fov, VIEWPORT_FOV_MIN, VIEWPORT_FOV_MAX);
+  vp->rebuild = viewport_stale(vp, src->width, src->height, dst_w, dst_h);
+  if (!vp->rebuild)
+    return 0;
+
+  if (!vp->xy[0] || vp->dst_w != dst_w || vp->dst_h != dst_h) {
+    size_t n[2] = { (size_t)dst_w * dst_h, (size_t)AV_CEIL_RSHIFT(dst_w, 1) * AV_CEIL_RSHIFT(dst_h, 1) };
+    for (int i = 0; i < 2; i++) {
+      av_freep(&vp->xy[i]);
+      av_freep(&vp->w[i]);
+      vp->xy[i] = (int32_t *)av_malloc_array(n[i], sizeof(*vp->xy[i]));
+      vp->w[i] = (uint16_t *)av_malloc_array(n[i], sizeof(*vp->w[i]));
+      if (!vp->xy[i] || !vp->w[i]) {
+        viewport_free(vp);
+        return AVERROR(ENOMEM);
+      }
+    }
+  }
+
+  // camera looks down +z with y down; pitch turns about x, then yaw about y
+  double cy = cos(vp->yaw * M_PI / 180), sy = sin(vp->yaw * M_PI / 180);
+  double cp = cos(vp->pitch * M_PI / 180), sp = sin(vp->pitch * M_PI / 180);
+  float m[9] = { (float)cy, (float)(sy * sp), (float)(sy * cp),
+                 0,         (float)cp,        (float)-sp,
+                 (float)-sy, (float)(cy * sp), (float)(cy * cp) };
+  memcpy(vp->m, m, sizeof(m));
+  vp->focal = (float)(dst_w * 0.5 / tan(vp->fov * M_PI / 360));
+  vp->src_w = src->width;
+  vp->src_h = src->height;
+  vp->dst_w = dst_w;
+  vp->dst_h = dst_h;
+  vp->built_yaw = vp->yaw;
+  vp->built_pitch = vp->pitch;
+  vp->built_fov = vp->fov;
+  return 0;
+}
+
+int viewport_render(const Viewport *vp, const AVFrame *src, uint8_t *const dst[3], const int dst_linesize[3],
+                    int y_start, int y_end)
+{
+  if (!vp->xy[0] || src->width != vp->src_w || src->height != vp->src_h ||
+      !viewport_supported((enum AVPixelFormat)src->format))
+    return AVERROR(EINVAL);
+
+  RemapRowFunc row = get_kernel()->row;
+  BuildRowFunc build = get_kernel()->build;
+  int nv12 = src->format == AV_PIX_FMT_NV12;
+  int cw = AV_CEIL_RSHIFT(vp->dst_w, 1);
+  int src_cw = AV_CEIL_RSHIFT(vp->src_w, 1);
+
+  y_end = FFMIN(y_end, vp->dst_h);
+  for (int y = y_start; y < y_end; y++) {
+    int32_t *xy = vp->xy[0] + (size_t)y * vp->dst_w;
+    uint16_t *w = vp->w[0] + (size_t)y * vp->dst_w;
+    if (vp->rebuild)
+      build(vp, xy, w, y, 0, vp->dst_w, 1, vp->src_w, vp->src_h);
+    row(src->data[0], src->linesize[0], 1, vp->src_w, xy, w, dst[0] + (ptrdiff_t)y * dst_linesize[0], 0, vp->dst_w);
+  }
+
+  for (int y = y_start >> 1; y < AV_CEIL_RSHIFT(y_end, 1); y++) {
+    int32_t *xy = vp->xy[1] + (size_t)y * cw;
+    uint16_t *w = vp->w[1] + (size_t)y * cw;
+    if (vp->rebuild)
+      build(vp, xy, w, y, 0, cw, 2, src_cw, AV_CEIL_RSHIFT(vp->src_h, 1));
+    uint8_t *u = dst[1] + (ptrdiff_t)y * dst_linesize[1];
+    uint8_t *v = dst[2] + (ptrdiff_t)y * dst_linesize[2];
+    if (nv12) {
+      row(src->data[1],     src->linesize[1], 2, 2 * src_cw,     xy, w, u, 0, cw);
+      row(src->data[1] + 1, src->linesize[1], 2, 2 * src_cw - 1, xy, w, v, 0, cw);
+    }
+    else {
+      row(src->data[1], src->linesize[1], 1, src_cw, xy, w, u, 0, cw);
+      row(src->data[2], src->linesize[2], 1, src_cw, xy, w, v, 0, cw);
+    }
+  }
+  return 0;
+}
+
+void viewport_free(Viewport *vp)
+{
+  for (int i = 0; i < 2; i++) {
+    av_freep(&vp->xy[i]);
+    av_freep(&vp->w[i]);
+  }
+}
+
+const char *viewport_kernel_name(void)
+{
+  return get_kernel()->name;
+}
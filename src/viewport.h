@@ -0,0 +1,63 @@
+#ifndef KSPLAYER_VIEWPORT_H
+#define KSPLAYER_VIEWPORT_H
+
+extern "C" {
+  #include <libavutil/frame.h>
+  #include <libavutil/pixfmt.h>
+}
+
+/**
+ *  perspective view into an equirectangular (360) picture, rendered to yuv420p
+ *  at the size it is shown. Every output sample has a remap table entry: the
+ *  source position it comes from and 7-bit bilinear weights. The tables depend
+ *  only on the view and the sizes, so they are rebuilt when those change and
+ *  each frame is a pure gather; the AVX2 kernel fetches 8 samples per gather.
+ *  The seam column at longitude 180 is sampled without blending across it.
+ */
+#define VIEWPORT_FOV_DEFAULT  90.0
+#define VIEWPORT_PITCH_MAX    89.0
+
+typedef struct Viewport {
+  /* the view, degrees; change it freely, the tables follow on the next viewport_update */
+  double yaw;       // positive looks right, wraps
+  double pitch;     // positive looks up, clamped to +-VIEWPORT_PITCH_MAX
+  double fov;       // horizontal
+
+  /* what the tables were built for */
+  double built_yaw, built_pitch, built_fov;
+  int src_w, src_h;
+  int dst_w, dst_h;
+  int rebuild;      // table rows are rebuilt by the slices of the next render
+  float m[9];       // view rotation, camera -> sphere
+  float focal;      // pixels
+
+  /* per output sample: x | y << 16 into the plane, fx | fy << 8 */
+  int32_t *xy[2];   // luma, chroma
+  uint16_t *w[2];
+} Viewport;
+
+/* 8-bit 4:2:0 layouts the kernels read */
+int viewport_supported(enum AVPixelFormat src);
+
+void viewport_init(Viewport *vp, double yaw, double pitch);
+
+/* view or sizes differ from what the tables were built for */
+int viewport_stale(const Viewport *vp, int src_w, int src_h, int dst_w, int dst_h);
+
+/* once per frame, before the slices: take the current view and size the tables */
+int viewport_update(Viewport *vp, const AVFrame *src, int dst_w, int dst_h);
+
+/**
+ *  output rows [y_start, y_end) into the yuv420p planes dst, which point at
+ *  row 0, rebuilding those table rows first if the view changed. y_start must
+ *  be even; row ranges of one frame may be rendered concurrently
+ */
+int viewport_render(const Viewport *vp, const AVFrame *src, uint8_t *const dst[3], const int dst_linesize[3],
+                    int y_start, int y_end);
+
+void viewport_free(Viewport *vp);
+
+/* name of the kernel in use, for logs */
+const char *viewport_kernel_name(void);
+
+#endif
@@ -0,0 +1,306 @@
+extern "C" {
+  #include <libavutil/cpu.h>
+  #include <libavutil/error.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+#include "yuv2rgb.h"
+
+/**
+ *  fixed point layout shared by every kernel, so they are bit exact:
+ *    sample' = (sample - offset) << 7                       int16
+ *    term    = (sample' * coef) >> 16, coef = value * 2^13   -> value * sample * 16
+ *    out     = clip((sum of terms + 8) >> 4)
+ *  all intermediates stay inside int16 for 8-bit input
+ */
+typedef struct YuvCoeffs {
+  int16_t yoff;
+  int16_t cy;     // luma scale
+  int16_t crv;    // V -> R
+  int16_t cgu;    // U -> G (subtracted)
+  int16_t cgv;    // V -> G (subtracted)
+  int16_t cbu;    // U -> B
+} YuvCoeffs;
+
+enum YuvMatrix { MATRIX_BT601, MATRIX_BT709, MATRIX_BT2020, MATRIX_NB };
+
+static constexpr int16_t q13(double v)
+{
+  return (int16_t)(v * 8192 + (v >= 0 ? 0.5 : -0.5));
+}
+
+template <int Matrix, bool Full>
+struct YuvCoeffTable {
+  static constexpr double kr = Matrix == MATRIX_BT601 ? 0.299  : Matrix == MATRIX_BT709 ? 0.2126 : 0.2627;
+  static constexpr double kb = Matrix == MATRIX_BT601 ? 0.114  : Matrix == MATRIX_BT709 ? 0.0722 : 0.0593;
+  static constexpr double kg = 1.0 - kr - kb;
+  static constexpr double ys = Full ? 1.0 : 255.0 / 219.0;
+  static constexpr double cs = Full ? 1.0 : 255.0 / 224.0;
+  static constexpr YuvCoeffs value = {
+    Full ? 0 : 16,
+    q13(ys),
+    q13(2 * (1 - kr) * cs),
+    q13(2 * (1 - kb) * kb / kg * cs),
+    q13(2 * (1 - kr) * kr / kg * cs),
+    q13(2 * (1 - kb) * cs),
+  };
+};
+
+static constexpr YuvCoeffs coeff_table[MATRIX_NB][2] = {
+  { YuvCoeffTable<MATRIX_BT601,  false>::value, YuvCoeffTable<MATRIX_BT601,  true>::value },
+  { YuvCoeffTable<MATRIX_BT709,  false>::value, YuvCoeffTable<MATRIX_BT709,  true>::value },
+  { YuvCoeffTable<MATRIX_BT2020, false>::value, YuvCoeffTable<MATRIX_BT2020, true>::value },
+};
+
+// the largest coefficient wrapping around int16 would show up as a negative one
+static_assert(coeff_table[MATRIX_BT601][0].cbu > 0 && coeff_table[MATRIX_BT709][0].cbu > 0 &&
+              coeff_table[MATRIX_BT2020][0].cbu > 0, "coefficients must fit int16");
+
+typedef void (*Yuv2RgbRowFunc)(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                               uint8_t *dst, int x, int width, const YuvCoeffs *c);
+
+static inline int mulhi(int a, int b)
+{
+  return (a * b) >> 16;
+}
+
+static inline uint8_t clip_u8(int v)
+{
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* reference kernel, also converts the tail columns for the SIMD ones */
+template <bool NV12, bool BGRA>
+static void yuv2rgb_row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                          uint8_t *dst, int x, int width, const YuvCoeffs *c)
+{
+  for (; x < width; x++) {
+    int Y = (y[x] - c->yoff) << 7;
+    int U = ((NV12 ? u[x & ~1]     : u[x >> 1]) - 128) << 7;
+    int V = ((NV12 ? u[(x & ~1) + 1] : v[x >> 1]) - 128) << 7;
+    int yt = mulhi(Y, c->cy);
+    int r = (yt + mulhi(V, c->crv) + 8) >> 4;
+    int g = (yt - mulhi(U, c->cgu) - mulhi(V, c->cgv) + 8) >> 4;
+    int b = (yt + mulhi(U, c->cbu) + 8) >> 4;
+    uint8_t *p = dst + 4 * x;
+    p[0] = clip_u8(BGRA ? b : r);
+    p[1] = clip_u8(g);
+    p[2] = clip_u8(BGRA ? r : b);
+    p[3] = 255;
+  }
+}
+
+#if HAVE_X86_KERNELS
+
+/* 8 pixels of 16-bit y/u/v (already offset and shifted) -> 8 RGBA/BGRA pixels */
+template <bool BGRA>
+static inline void store_px_sse2(uint8_t *dst, __m128i y, __m128i u, __m128i v, const YuvCoeffs *c)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16(255);
+  const __m128i rnd = _mm_set1_epi16(8);
+  __m128i yt = _mm_mulhi_epi16(y, _mm_set1_epi16(c->cy));
+  __m128i r = _mm_add_epi16(yt, _mm_mulhi_epi16(v, _mm_set1_epi16(c->crv)));
+  __m128i g = _mm_sub_epi16(_mm_sub_epi16(yt, _mm_mulhi_epi16(u, _mm_set1_epi16(c->cgu))),
+                            _mm_mulhi_epi16(v, _mm_set1_epi16(c->cgv)));
+  __m128i b = _mm_add_epi16(yt, _mm_mulhi_epi16(u, _mm_set1_epi16(c->cbu)));
+  r = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(_mm_add_epi16(r, rnd), 4), zero), max);
+  g = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(_mm_add_epi16(g, rnd), 4), zero), max);
+  b = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(_mm_add_epi16(b, rnd), 4), zero), max);
+
+  __m128i lo = _mm_or_si128(BGRA ? b : r, _mm_slli_epi16(g, 8));
+  __m128i hi = _mm_or_si128(BGRA ? r : b, _mm_set1_epi16((short)0xff00));
+  _mm_storeu_si128((__m128i *)dst,        _mm_unpacklo_epi16(lo, hi));
+  _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(lo, hi));
+}
+
+template <bool NV12, bool BGRA>
+static void yuv2rgb_row_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                             uint8_t *dst, int x, int width, const YuvCoeffs *c)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i yoff = _mm_set1_epi16(c->yoff);
+  const __m128i c128 = _mm_set1_epi16(128);
+
+  for (; x + 16 <= width; x += 16) {
+    __m128i yy = _mm_loadu_si128((const __m128i *)(y + x));
+    __m128i y0 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), yoff), 7);
+    __m128i y1 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), yoff), 7);
+    __m128i uu, vv;
+    if (NV12) {
+      __m128i uv = _mm_loadu_si128((const __m128i *)(u + x));
+      uu = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+      vv = _mm_srli_epi16(uv, 8);
+    }
+    else {
+      uu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + (x >> 1))), zero);
+      vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + (x >> 1))), zero);
+    }
+    uu = _mm_slli_epi16(_mm_sub_epi16(uu, c128), 7);
+    vv = _mm_slli_epi16(_mm_sub_epi16(vv, c128), 7);
+
+    store_px_sse2<BGRA>(dst + 4 * x,      y0, _mm_unpacklo_epi16(uu, uu), _mm_unpacklo_epi16(vv, vv), c);
+    store_px_sse2<BGRA>(dst + 4 * x + 32, y1, _mm_unpackhi_epi16(uu, uu), _mm_unpackhi_epi16(vv, vv), c);
+  }
+  yuv2rgb_row_c<NV12, BGRA>(y, u, v, dst, x, width, c);
+}
+
+/* 16 pixels of 16-bit y/u/v -> 16 RGBA/BGRA pixels */
+template <bool BGRA>
+__attribute__((target("avx2")))
+static inline void store_px_avx2(uint8_t *dst, __m256i y, __m256i u, __m256i v, const YuvCoeffs *c)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi16(255);
+  const __m256i rnd = _mm256_set1_epi16(8);
+  __m256i yt = _mm256_mulhi_epi16(y, _mm256_set1_epi16(c->cy));
+  __m256i r = _mm256_add_epi16(yt, _mm256_mulhi_epi16(v, _mm256_set1_epi16(c->crv)));
+  __m256i g = _mm256_sub_epi16(_mm256_sub_epi16(yt, _mm256_mulhi_epi16(u, _mm256_set1_epi16(c->cgu))),
+                               _mm256_mulhi_epi16(v, _mm256_set1_epi16(c->cgv)));
+  __m256i b = _mm256_add_epi16(yt, _mm256_mulhi_epi16(u, _mm256_set1_epi16(c->cbu)));
+  r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(_mm256_add_epi16(r, rnd), 4), zero), max);
+  g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(_mm256_add_epi16(g, rnd), 4), zero), max);
+  b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(_mm256_add_epi16(b, rnd), 4), zero), max);
+
+  __m256i lo = _mm256_or_si256(BGRA ? b : r, _mm256_slli_epi16(g, 8));
+  __m256i hi = _mm256_or_si256(BGRA ? r : b, _mm256_set1_epi16((short)0xff00));
+  // unpack works per 128-bit lane: px 0-3|8-11 and 4-7|12-15
+  __m256i p0 = _mm256_unpacklo_epi16(lo, hi);
+  __m256i p1 = _mm256_unpackhi_epi16(lo, hi);
+  _mm256_storeu_si256((__m256i *)dst,        _mm256_permute2x128_si256(p0, p1, 0x20));
+  _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+}
+
+template <bool NV12, bool BGRA>
+__attribute__((target("avx2")))
+static void yuv2rgb_row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                             uint8_t *dst, int x, int width, const YuvCoeffs *c)
+{
+  const __m256i yoff = _mm256_set1_epi16(c->yoff);
+  const __m256i c128 = _mm256_set1_epi16(128);
+
+  for (; x + 32 <= width; x += 32) {
+    __m256i y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+    __m256i y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x + 16)));
+    y0 = _mm256_slli_epi16(_mm256_sub_epi16(y0, yoff), 7);
+    y1 = _mm256_slli_epi16(_mm256_sub_epi16(y1, yoff), 7);
+    __m256i uu, vv;
+    if (NV12) {
+      __m256i uv = _mm256_loadu_si256((const __m256i *)(u + x));
+      uu = _mm256_and_si256(uv, _mm256_set1_epi16(0xff));
+      vv = _mm256_srli_epi16(uv, 8);
+    }
+    else {
+      uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + (x >> 1))));
+      vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + (x >> 1))));
+    }
+    uu = _mm256_slli_epi16(_mm256_sub_epi16(uu, c128), 7);
+    vv = _mm256_slli_epi16(_mm256_sub_epi16(vv, c128), 7);
+    // quads 0,2,1,3 so the per-lane unpacks below duplicate samples 0-7 and 8-15 in order
+    uu = _mm256_permute4x64_epi64(uu, _MM_SHUFFLE(3, 1, 2, 0));
+    vv = _mm256_permute4x64_epi64(vv, _MM_SHUFFLE(3, 1, 2, 0));
+
+    store_px_avx2<BGRA>(dst + 4 * x,      y0, _mm256_unpacklo_epi16(uu, uu), _mm256_unpacklo_epi16(vv, vv), c);
+    store_px_avx2<BGRA>(dst + 4 * x + 64, y1, _mm256_unpackhi_epi16(uu, uu), _mm256_unpackhi_epi16(vv, vv), c);
+  }
+  yuv2rgb_row_c<NV12, BGRA>(y, u, v, dst, x, width, c);
+}
+
+#endif
+
+/* [nv12][bgra] */
+typedef struct Yuv2RgbKernels {
+  const char *name;
+  Yuv2RgbRowFunc row[2][2];
+} Yuv2RgbKernels;
+
+static const Yuv2RgbKernels kernels_c = {
+  "c", { { yuv2rgb_row_c<false, false>, yuv2rgb_row_c<false, true> },
+         { yuv2rgb_row_c<true, false>,  yuv2rgb_row_c<true, true> } },
+};
+
+#if HAVE_X86_KERNELS
+static const Yuv2RgbKernels kernels_sse2 = {
+  "sse2", { { yuv2rgb_row_sse2<false, false>, yuv2rgb_row_sse2<false, true> },
+            { yuv2rgb_row_sse2<true, false>,  yuv2rgb_row_sse2<true, true> } },
+};
+
+static const Yuv2RgbKernels kernels_avx2 = {
+  "avx2", { { yuv2rgb_row_avx2<false, false>, yuv2rgb_row_avx2<false, true> },
+            { yuv2rgb_row_avx2<true, false>,  yuv2rgb_row_avx2<true, true> } },
+};
+#endif
+
+static const Yuv2RgbKernels *select_kernels(void)
+{
+#if HAVE_X86_KERNELS
+  int flags = av_get_cpu_flags();
+  if (flags & AV_CPU_FLAG_AVX2)
+    return &kernels_avx2;
+  if (flags & AV_CPU_FLAG_SSE2)
+    return &kernels_sse2;
+#endif
+  return &kernels_c;
+}
+
+static const Yuv2RgbKernels *get_kernels(void)
+{
+  static const Yuv2RgbKernels *kernels = select_kernels();
+  return kernels;
+}
+
+static const YuvCoeffs *select_coeffs(const AVFrame *frame)
+{
+  int full = frame->color_range == AVCOL_RANGE_JPEG;
+  switch (frame->colorspace) {
+    case AVCOL_SPC_BT709:
+      return &coeff_table[MATRIX_BT709][full];
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+      return &coeff_table[MATRIX_BT2020][full];
+    case AVCOL_SPC_UNSPECIFIED:
+      // untagged HD is far more often 709 than 601
+      return &coeff_table[frame->height > 576 ? MATRIX_BT709 : MATRIX_BT601][full];
+    default:
+      return &coeff_table[MATRIX_BT601][full];
+  }
+}
+
+int yuv2rgb_supported(enum AVPixelFormat src, enum AVPixelFormat dst)
+{
+  return (src == AV_PIX_FMT_YUV420P || src == AV_PIX_FMT_NV12 || src == AV_PIX_FMT_YUV422P) &&
+         (dst == AV_PIX_FMT_RGBA || dst == AV_PIX_FMT_BGRA);
+}
+
+int yuv2rgb_convert(const AVFrame *src, uint8_t *dst, int dst_linesize, enum AVPixelFormat dst_fmt,
+                    int y_start, int y_end)
+{
+  if (!yuv2rgb_supported((enum AVPixelFormat)src->format, dst_fmt))
+    return AVERROR(ENOSYS);
+
+  int nv12 = src->format == AV_PIX_FMT_NV12;
+  int chroma_shift = src->format == AV_PIX_FMT_YUV422P ? 0 : 1;
+  Yuv2RgbRowFunc row = get_kernels()->row[nv12][dst_fmt == AV_PIX_FMT_BGRA];
+  const YuvCoeffs *c = select_coeffs(src);
+
+  y_end = FFMIN(y_end, src->height);
+  for (int y = y_start; y < y_end; y++) {
+    int cy = y >> chroma_shift;
+    row(src->data[0] + (ptrdiff_t)y * src->linesize[0],
+        src->data[1] + (ptrdiff_t)cy * src->linesize[1],
+        nv12 ? NULL : src->data[2] + (ptrdiff_t)cy * src->linesize[2],
+        dst + (ptrdiff_t)y * dst_linesize, 0, src->width, c);
+  }
+  return 0;
+}
+
+const char *yuv2rgb_kernel_name(void)
+{
+  return get_kernels()->name;
+}
@@ -0,0 +1,28 @@
+#ifndef KSPLAYER_YUV2RGB_H
+#define KSPLAYER_YUV2RGB_H
+
+extern "C" {
+  #include <libavutil/frame.h>
+  #include <libavutil/pixfmt.h>
+}
+
+/**
+ *  YUV420P / NV12 / YUV422P -> RGBA / BGRA for renderers without YUV textures,
+ *  instead of a generic sws_scale. BT.601 / BT.709 / BT.2020 in limited or full
+ *  range, chroma upsampled by duplication. Scalar, SSE2 and AVX2 row kernels
+ *  produce identical output; the widest one the CPU has is picked at runtime
+ *  through av_get_cpu_flags.
+ */
+int yuv2rgb_supported(enum AVPixelFormat src, enum AVPixelFormat dst);
+
+/**
+ *  convert rows [y_start, y_end) of src into dst, which points at row 0.
+ *  Row ranges of one frame may be converted concurrently
+ */
+int yuv2rgb_convert(const AVFrame *src, uint8_t *dst, int dst_linesize, enum AVPixelFormat dst_fmt,
+                    int y_start, int y_end);
+
+/* name of the kernel set in use, for logs */
+const char *yuv2rgb_kernel_name(void);
+
+#endif